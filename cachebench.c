@@ -0,0 +1,197 @@
+/*
+ * cachebench.c - compare the front-end caches under many threads.
+ *
+ * Each of NTHREADS threads, many more than there are CPUs, keeps a working
+ * set of WORKSET small blocks and repeatedly replaces a random one with a
+ * block of random size.  The run is repeated with no caches, where a
+ * single lock serializes mm_malloc() and mm_free(), with per-thread
+ * caches and with per-CPU caches.  For each we report the throughput, the
+ * heap size, and the bytes held in caches once the threads are done but
+ * before they exit.
+ *
+ * A second workload pairs the threads up: one of each pair allocates
+ * blocks and hands them to the other, which frees them, so that every
+ * block crosses from one thread's cache to another's.
+ *
+ * usage: cachebench [nthreads]
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define NTHREADS 64     /* default number of threads */
+#define WORKSET  256    /* blocks each thread keeps */
+#define NOPS     100000 /* replacements per thread */
+#define MAXSIZE  512    /* largest request */
+#define RINGSIZE 1024   /* blocks in flight between a pair of threads */
+
+/* A ring of blocks handed from one thread to another */
+typedef struct {
+    _Atomic(void *) slots[RINGSIZE];
+    unsigned int head, tail;   /* owned by the consumer and producer */
+} ring_t;
+
+static int mode;                 /* MM_CACHE_* of the current run */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; /* MM_CACHE_NONE */
+static pthread_barrier_t done;   /* the threads are done but not gone */
+static size_t cached;            /* mm_cache_bytes() at the barrier */
+static ring_t *rings;            /* handoff runs: one per pair of threads */
+
+static void *bench_malloc(size_t size)
+{
+    void *p;
+
+    if (mode != MM_CACHE_NONE)
+	return mm_malloc(size);
+    pthread_mutex_lock(&lock);
+    p = mm_malloc(size);
+    pthread_mutex_unlock(&lock);
+    return p;
+}
+
+static void bench_free(void *p)
+{
+    if (mode != MM_CACHE_NONE) {
+	mm_free(p);
+	return;
+    }
+    pthread_mutex_lock(&lock);
+    mm_free(p);
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * worker - churn a working set of blocks, then free it and wait at the
+ *     barrier so that the caches can be measured before threads exit
+ */
+static void *worker(void *arg)
+{
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    void *blocks[WORKSET];
+    int i, j;
+
+    for (i = 0; i < WORKSET; i++)
+	blocks[i] = NULL;
+    for (i = 0; i < NOPS; i++) {
+	j = rand_r(&seed) % WORKSET;
+	bench_free(blocks[j]);
+	blocks[j] = bench_malloc(1 + rand_r(&seed) % MAXSIZE);
+	if (blocks[j] == NULL) {
+	    fprintf(stderr, "cachebench: out of memory\n");
+	    exit(1);
+	}
+	*(char *)blocks[j] = (char)i;
+    }
+    for (i = 0; i < WORKSET; i++)
+	bench_free(blocks[i]);
+    if (pthread_barrier_wait(&done) == PTHREAD_BARRIER_SERIAL_THREAD)
+	cached = mm_cache_bytes();
+    pthread_barrier_wait(&done);
+    return NULL;
+}
+
+/*
+ * handoff - allocate NOPS blocks into a ring if "arg" is odd, and free
+ *     them on the other side if it is even
+ */
+static void *handoff(void *arg)
+{
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    ring_t *r = &rings[(seed - 1) / 2];
+    int producer = seed % 2, i;
+    void *p;
+
+    for (i = 0; i < NOPS; i++) {
+	if (producer) {
+	    while (atomic_load(&r->slots[r->tail % RINGSIZE]) != NULL)
+		sched_yield();
+	    if ((p = bench_malloc(1 + rand_r(&seed) % MAXSIZE)) == NULL) {
+		fprintf(stderr, "cachebench: out of memory\n");
+		exit(1);
+	    }
+	    atomic_store(&r->slots[r->tail++ % RINGSIZE], p);
+	} else {
+	    while ((p = atomic_load(&r->slots[r->head % RINGSIZE])) == NULL)
+		sched_yield();
+	    atomic_store(&r->slots[r->head++ % RINGSIZE], NULL);
+	    bench_free(p);
+	}
+    }
+    if (pthread_barrier_wait(&done) == PTHREAD_BARRIER_SERIAL_THREAD)
+	cached = mm_cache_bytes();
+    pthread_barrier_wait(&done);
+    return NULL;
+}
+
+static void run(const char *name, int m, int nthreads, void *(*fn)(void *))
+{
+    pthread_t *threads;
+    struct timeval start, end;
+    double secs;
+    int i;
+
+    mem_reset_brk();
+    if (mm_init() < 0 || mm_cache_enable(m) < 0) {
+	fprintf(stderr, "cachebench: cannot set up %s\n", name);
+	exit(1);
+    }
+    mode = m;
+    if ((threads = malloc(nthreads * sizeof(pthread_t))) == NULL) {
+	fprintf(stderr, "cachebench: out of memory\n");
+	exit(1);
+    }
+    pthread_barrier_init(&done, NULL, nthreads);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nthreads; i++)
+	pthread_create(&threads[i], NULL, fn, (void *)(uintptr_t)(i + 1));
+    for (i = 0; i < nthreads; i++)
+	pthread_join(threads[i], NULL);
+    gettimeofday(&end, NULL);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    printf("%-8s %10.0f %12zu %12zu\n", name,
+	   (double)nthreads * NOPS * 2 / secs / 1e3,
+	   mem_heapsize() / 1024, cached / 1024);
+    pthread_barrier_destroy(&done);
+    free(threads);
+    mm_cache_enable(MM_CACHE_NONE);
+}
+
+int main(int argc, char **argv)
+{
+    int nthreads = argc > 1 ? atoi(argv[1]) : NTHREADS;
+
+    if (nthreads < 2) {
+	fprintf(stderr, "usage: cachebench [nthreads]\n");
+	exit(1);
+    }
+    mem_init();
+    printf("%d threads x %d ops on %d blocks of 1..%d bytes\n",
+	   nthreads, NOPS, WORKSET, MAXSIZE);
+    printf("%-8s %10s %12s %12s\n", "caches", "Kops", "heap KB", "cached KB");
+    run("none", MM_CACHE_NONE, nthreads, worker);
+    run("thread", MM_CACHE_THREAD, nthreads, worker);
+    run("cpu", MM_CACHE_CPU, nthreads, worker);
+
+    nthreads &= ~1;
+    if ((rings = calloc(nthreads / 2, sizeof(ring_t))) == NULL) {
+	fprintf(stderr, "cachebench: out of memory\n");
+	exit(1);
+    }
+    printf("\n%d pairs handing %d blocks from one thread to the other\n",
+	   nthreads / 2, NOPS);
+    run("none", MM_CACHE_NONE, nthreads, handoff);
+    run("thread", MM_CACHE_THREAD, nthreads, handoff);
+    run("cpu", MM_CACHE_CPU, nthreads, handoff);
+    free(rings);
+    mem_deinit();
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * colourbench.c - measure what colouring tiny pages buys.
+ *
+ * Tiny blocks are allocated until MAXPAGES tiny pages exist, and the
+ * first block of each page, the one the allocator hands out first, is
+ * noted.  Because tiny pages are coloured, those blocks sit at different
+ * offsets within their pages.  We then repeatedly read the first blocks
+ * of the first n pages, and, for comparison, the same pages at the one
+ * offset that every first block would have without colouring.  For each
+ * n we report the time per read and, when the kernel lets us count them,
+ * the L1 data cache misses per read.
+ *
+ * usage: colourbench
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "ftimer.h"
+
+#define MAXPAGES 256   /* tiny pages whose first blocks are walked */
+#define NREPS    1000  /* walks per timed or counted run */
+#define NPASSES  20    /* runs averaged by ftimer_gettod */
+
+typedef struct {
+    char **addrs;      /* addresses to read */
+    int n;             /* how many of them */
+} walk_t;
+
+static volatile long sum;   /* keeps the walks from being optimized away */
+
+static void walk(void *argp)
+{
+    walk_t *w = (walk_t *)argp;
+    long s = 0;
+    int i, rep;
+
+    for (rep = 0; rep < NREPS; rep++)
+	for (i = 0; i < w->n; i++)
+	    s += *(volatile long *)w->addrs[i];
+    sum = s;
+}
+
+/*
+ * open_misses - open a counter of L1 data cache read misses for this
+ *     process, or return -1 if perf events are not available
+ */
+static int open_misses(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D |
+	(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * measure - time a walk and count its misses; write the misses per read
+ *     into buf, and return the nanoseconds per read
+ */
+static double measure(walk_t *w, int fd, char *buf, size_t len)
+{
+    long long misses;
+    double secs;
+
+    walk(w);   /* warm up */
+    secs = ftimer_gettod(walk, w, NPASSES);
+
+    snprintf(buf, len, "n/a");
+    if (fd >= 0) {
+	ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+	ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	walk(w);
+	ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(fd, &misses, sizeof(misses)) == sizeof(misses))
+	    snprintf(buf, len, "%.3f", (double)misses / NREPS / w->n);
+    }
+    return secs * 1e9 / NREPS / w->n;
+}
+
+int main(void)
+{
+    static char *first[MAXPAGES], *plain[MAXPAGES];
+    uintptr_t pagemask = ~(uintptr_t)(mem_pagesize() - 1);
+    uintptr_t offset, base = mem_pagesize();
+    walk_t coloured, uncoloured;
+    char cbuf[32], ubuf[32];
+    double cns, uns;
+    int fd, npages = 0, n;
+    char *p;
+
+    mem_init();
+    if (mm_init() < 0) {
+	fprintf(stderr, "colourbench: mm_init failed\n");
+	exit(1);
+    }
+
+    /* Note the first block of each new tiny page. */
+    while (npages < MAXPAGES) {
+	if ((p = mm_malloc(sizeof(long))) == NULL) {
+	    fprintf(stderr, "colourbench: out of memory\n");
+	    exit(1);
+	}
+	*(long *)p = 1;
+	if (npages == 0 || ((uintptr_t)p & pagemask) !=
+	    ((uintptr_t)first[npages - 1] & pagemask))
+	    first[npages++] = p;
+    }
+
+    /* Without colouring, every first block would be at the least offset. */
+    for (n = 0; n < MAXPAGES; n++) {
+	offset = (uintptr_t)first[n] & ~pagemask;
+	if (offset < base)
+	    base = offset;
+    }
+    for (n = 0; n < MAXPAGES; n++)
+	plain[n] = (char *)(((uintptr_t)first[n] & pagemask) + base);
+
+    fd = open_misses();
+    printf("first blocks of %d tiny pages, %d reads of each per walk\n",
+	   MAXPAGES, NREPS);
+    printf("%6s %12s %14s %12s %14s\n", "pages", "coloured ns",
+	   "misses/read", "plain ns", "misses/read");
+    coloured.addrs = first;
+    uncoloured.addrs = plain;
+    for (n = 8; n <= MAXPAGES; n *= 2) {
+	coloured.n = uncoloured.n = n;
+	cns = measure(&coloured, fd, cbuf, sizeof(cbuf));
+	uns = measure(&uncoloured, fd, ubuf, sizeof(ubuf));
+	printf("%6d %12.2f %14s %12.2f %14s\n", n, cns, cbuf, uns, ubuf);
+    }
+
+    if (fd >= 0)
+	close(fd);
+    mem_deinit();
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * falsebench.c - measure false sharing between blocks that mm_malloc()
+ * hands to different threads.
+ *
+ * Each thread repeatedly allocates a small block, writes to it WRITES
+ * times and frees it.  Blocks of different threads that share a cache
+ * line make the line bounce between CPUs on every write, although the
+ * threads share no data.  In the active test, the threads start with
+ * nothing, so any sharing is caused by the allocator handing
+ * neighbouring blocks to different threads.  In the passive test, the
+ * main thread first allocates one block per thread, all likely on the
+ * same line, and each thread starts by freeing the one it was given, so
+ * an allocator that reuses a freed block for the thread that freed it
+ * keeps the threads on that line.
+ *
+ * Each test is run for 1 to nthreads threads.  For each we report the
+ * writes per second, and how many of the threads' blocks shared a
+ * cache line with the block another thread was writing to at the time.
+ *
+ * usage: falsebench [-c thread|cpu] [-s bytes] [nthreads]
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define NTHREADS 8      /* default largest number of threads */
+#define NITER    2000   /* blocks each thread allocates */
+#define WRITES   20000  /* writes to each block */
+#define OBJSIZE  8      /* default bytes per block */
+#define LINESIZE 64     /* bytes per cache line */
+
+/* What each thread is doing, padded to keep it on lines of its own */
+typedef struct {
+    _Atomic uintptr_t line;     /* line of the block being written, or 0 */
+    void *given;                /* passive test: the block to free first */
+    unsigned long shared;       /* blocks that shared a line */
+    char pad[LINESIZE];
+} thread_t;
+
+static thread_t *threads;
+static int nthreads;
+static size_t objsize = OBJSIZE;
+static pthread_barrier_t start;
+
+/*
+ * shares_line - does another thread's current block share the line?
+ */
+static int shares_line(int self, uintptr_t line)
+{
+    int t;
+
+    for (t = 0; t < nthreads; t++)
+	if (t != self && atomic_load(&threads[t].line) == line)
+	    return 1;
+    return 0;
+}
+
+/*
+ * worker - allocate, write and free NITER blocks, first freeing the
+ *     block given to the thread, if any
+ */
+static void *worker(void *arg)
+{
+    int self = (int)(uintptr_t)arg;
+    thread_t *me = &threads[self];
+    volatile char *p;
+    uintptr_t line;
+    size_t k;
+    int i, j;
+
+    pthread_barrier_wait(&start);
+    if (me->given != NULL)
+	mm_free(me->given);
+    for (i = 0; i < NITER; i++) {
+	if ((p = mm_malloc(objsize)) == NULL) {
+	    fprintf(stderr, "falsebench: out of memory\n");
+	    exit(1);
+	}
+	line = (uintptr_t)p / LINESIZE;
+	atomic_store(&me->line, line);
+	if (shares_line(self, line))
+	    me->shared++;
+	for (j = 0, k = 0; j < WRITES; j++, k = k + 1 < objsize ? k + 1 : 0)
+	    p[k]++;
+	atomic_store(&me->line, 0);
+	mm_free((void *)p);
+    }
+    return NULL;
+}
+
+static void run(int mode, int n, int passive)
+{
+    pthread_t *tids;
+    struct timeval begin, end;
+    unsigned long shared = 0;
+    double secs;
+    int t;
+
+    mem_reset_brk();
+    if (mm_init() < 0 || mm_cache_enable(mode) < 0) {
+	fprintf(stderr, "falsebench: cannot set up the caches\n");
+	exit(1);
+    }
+    nthreads = n;
+    if ((tids = malloc(n * sizeof(pthread_t))) == NULL ||
+	(threads = calloc(n, sizeof(thread_t))) == NULL) {
+	fprintf(stderr, "falsebench: out of memory\n");
+	exit(1);
+    }
+    for (t = 0; t < n; t++)
+	if (passive && (threads[t].given = mm_malloc(objsize)) == NULL) {
+	    fprintf(stderr, "falsebench: out of memory\n");
+	    exit(1);
+	}
+    pthread_barrier_init(&start, NULL, n);
+
+    gettimeofday(&begin, NULL);
+    for (t = 0; t < n; t++)
+	pthread_create(&tids[t], NULL, worker, (void *)(uintptr_t)t);
+    for (t = 0; t < n; t++)
+	pthread_join(tids[t], NULL);
+    gettimeofday(&end, NULL);
+    secs = (end.tv_sec - begin.tv_sec) + (end.tv_usec - begin.tv_usec) / 1e6;
+
+    for (t = 0; t < n; t++)
+	shared += threads[t].shared;
+    printf("%7d %12.0f %9.1f%%\n", n,
+	   (double)n * NITER * WRITES / secs / 1e6,
+	   100.0 * shared / ((double)n * NITER));
+    pthread_barrier_destroy(&start);
+    free(threads);
+    free(tids);
+    mm_cache_enable(MM_CACHE_NONE);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+	    "usage: falsebench [-c thread|cpu] [-s bytes] [nthreads]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int mode = MM_CACHE_THREAD, maxthreads = NTHREADS, n, c;
+
+    while ((c = getopt(argc, argv, "c:s:")) != EOF) {
+	if (c == 's' && atoi(optarg) > 0)
+	    objsize = atoi(optarg);
+	else if (c == 'c' && strcmp(optarg, "thread") == 0)
+	    mode = MM_CACHE_THREAD;
+	else if (c == 'c' && strcmp(optarg, "cpu") == 0)
+	    mode = MM_CACHE_CPU;
+	else
+	    usage();
+    }
+    if (optind < argc && (maxthreads = atoi(argv[optind])) < 1)
+	usage();
+
+    mem_init();
+    printf("%d blocks of %zu bytes per thread, written %d times each, "
+	   "%s caches\n", NITER, objsize, WRITES,
+	   mode == MM_CACHE_THREAD ? "per-thread" : "per-CPU");
+    printf("\nActive false sharing\n");
+    printf("%7s %12s %10s\n", "threads", "Mwrites/s", "shared");
+    for (n = 1; n <= maxthreads; n++)
+	run(mode, n, 0);
+    printf("\nPassive false sharing\n");
+    printf("%7s %12s %10s\n", "threads", "Mwrites/s", "shared");
+    for (n = 1; n <= maxthreads; n++)
+	run(mode, n, 1);
+    mem_deinit();
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * larson.c - a larson-style simulation of a server under mm_malloc().
+ *
+ * Each of nthreads server slots owns an array of NSLOTS blocks, filled by
+ * the main thread before the clock starts.  In each of ROUNDS rounds, a
+ * new thread takes over every slot's array from the previous one and
+ * replaces NOPS random blocks with blocks of random size, so that most
+ * blocks are freed by other threads than the ones that allocated them,
+ * as when a server hands connections from one worker to the next.  The
+ * run is repeated for 1 to nthreads slots, and for each we report the
+ * throughput and the heap size, which mem_sbrk() never lets shrink and
+ * so is also the peak heap size.
+ *
+ * usage: larson [-c thread|cpu] [nthreads]
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define NTHREADS 8      /* default largest number of threads */
+#define NSLOTS   1000   /* blocks in each slot's array */
+#define ROUNDS   8      /* threads that take over each slot in turn */
+#define NOPS     20000  /* replacements by each thread */
+#define MINSIZE  16     /* smallest request */
+#define MAXSIZE  256    /* largest request */
+
+/* A server slot: the blocks handed from each thread to the next */
+typedef struct {
+    void *blocks[NSLOTS];
+    unsigned int seed;
+} slot_t;
+
+static void *bench_malloc(size_t size)
+{
+    void *p;
+
+    if ((p = mm_malloc(size)) == NULL) {
+	fprintf(stderr, "larson: out of memory\n");
+	exit(1);
+    }
+    *(char *)p = (char)size;
+    return p;
+}
+
+static size_t random_size(unsigned int *seed)
+{
+    return MINSIZE + rand_r(seed) % (MAXSIZE - MINSIZE + 1);
+}
+
+/*
+ * worker - replace NOPS random blocks of the slot's array
+ */
+static void *worker(void *arg)
+{
+    slot_t *s = (slot_t *)arg;
+    int i, j;
+
+    for (i = 0; i < NOPS; i++) {
+	j = rand_r(&s->seed) % NSLOTS;
+	mm_free(s->blocks[j]);
+	s->blocks[j] = bench_malloc(random_size(&s->seed));
+    }
+    return NULL;
+}
+
+static void run(int mode, int nthreads)
+{
+    pthread_t *threads;
+    slot_t *slots;
+    struct timeval start, end;
+    double secs;
+    int i, j, round;
+
+    mem_reset_brk();
+    if (mm_init() < 0 || mm_cache_enable(mode) < 0) {
+	fprintf(stderr, "larson: cannot set up the caches\n");
+	exit(1);
+    }
+    if ((threads = malloc(nthreads * sizeof(pthread_t))) == NULL ||
+	(slots = malloc(nthreads * sizeof(slot_t))) == NULL) {
+	fprintf(stderr, "larson: out of memory\n");
+	exit(1);
+    }
+    for (i = 0; i < nthreads; i++) {
+	slots[i].seed = i + 1;
+	for (j = 0; j < NSLOTS; j++)
+	    slots[i].blocks[j] = bench_malloc(random_size(&slots[i].seed));
+    }
+
+    gettimeofday(&start, NULL);
+    for (round = 0; round < ROUNDS; round++) {
+	for (i = 0; i < nthreads; i++)
+	    pthread_create(&threads[i], NULL, worker, &slots[i]);
+	for (i = 0; i < nthreads; i++)
+	    pthread_join(threads[i], NULL);
+    }
+    gettimeofday(&end, NULL);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    printf("%7d %10.0f %10zu\n", nthreads,
+	   (double)nthreads * ROUNDS * NOPS * 2 / secs / 1e3,
+	   mem_heapsize() / 1024);
+    for (i = 0; i < nthreads; i++)
+	for (j = 0; j < NSLOTS; j++)
+	    mm_free(slots[i].blocks[j]);
+    free(slots);
+    free(threads);
+    mm_cache_enable(MM_CACHE_NONE);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: larson [-c thread|cpu] [nthreads]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int mode = MM_CACHE_THREAD, nthreads = NTHREADS, n, c;
+
+    while ((c = getopt(argc, argv, "c:")) != EOF) {
+	if (c != 'c')
+	    usage();
+	if (strcmp(optarg, "thread") == 0)
+	    mode = MM_CACHE_THREAD;
+	else if (strcmp(optarg, "cpu") == 0)
+	    mode = MM_CACHE_CPU;
+	else
+	    usage();
+    }
+    if (optind < argc && (nthreads = atoi(argv[optind])) < 1)
+	usage();
+
+    mem_init();
+    printf("%d rounds of threads making %d replacements in %d blocks of "
+	   "%d..%d bytes, %s caches\n", ROUNDS, NOPS, NSLOTS, MINSIZE, MAXSIZE,
+	   mode == MM_CACHE_THREAD ? "per-thread" : "per-CPU");
+    printf("%7s %10s %10s\n", "threads", "Kops", "heap KB");
+    for (n = 1; n <= nthreads; n++)
+	run(mode, n);
+    mem_deinit();
+    return 0;
+}
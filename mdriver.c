@@ -12,15 +12,25 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -31,6 +41,37 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Blocks freed within this fraction of a trace's ops count as short-lived */
+#define SHORT_LIFETIME 0.05
+
+/* 
+ * With -R, each op takes OP_SECS of synthetic time, pages decay over
+ * DECAY_FRAC of the trace's duration, and RSS is sampled RSS_RUN times
+ * during the trace and RSS_IDLE times during one decay time of idling.
+ */
+#define OP_SECS    0.001
+#define DECAY_FRAC 0.25
+#define RSS_RUN    8
+#define RSS_IDLE   2
+#define NRSS       (RSS_RUN + RSS_IDLE)
+
+/* With -A, block id i is allocated with tag TAG_OF(i), one of NTAGS */
+#define NTAGS      16
+#define TAG_OF(i)  ((int)((i) % NTAGS) + 1)
+
+/* Runs of each -T replay, of which the fastest counts */
+#define THREAD_RUNS 3
+
+/* The simulated heap's size; each of the -T threads needs a full one */
+#define HEAP_SIZE ((size_t)MAX_HEAP * (nthreads > 1 ? nthreads : 1))
+
+/* Largest number of threads in a multi-threaded trace */
+#define MAXTHREADS 1024
+#define THREAD_OF(trace, i) ((trace)->threads ? (trace)->threads[i] : 0)
+
+/* Requests in each of the two chunks a streamed trace is read in (-S) */
+#define CHUNK_OPS  4096
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
@@ -45,13 +86,6 @@ typedef struct range_t {
     struct range_t *next;  /* next list element */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     unsigned sugg_heapsize;   /* suggested heap size (unused) */
@@ -59,10 +93,35 @@ typedef struct {
     unsigned num_ops;         /* number of distinct requests */
     unsigned weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
+    void *map;           /* the mapped file, if ops points into a binary one */
+    size_t map_size;     /* ... and its size */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    int *hints;          /* actual lifetime of each ALLOC op, as a hint (-L) */
+    unsigned *threads;   /* the thread of each request, or NULL if all 0 */
+    unsigned num_threads;/* number of threads the requests came from */
 } trace_t;
 
+/*
+ * Holds a trace that is replayed as it is read (-S).  A reader thread
+ * fills one chunk of requests while the replay drains the other, so only
+ * the two chunks and the table of block pointers stay in memory.
+ */
+typedef struct {
+    int fd;              /* the trace file, read past its header... */
+    FILE *file;          /* ... through stdio if it is a text trace */
+    char *path;          /* its path, for error messages */
+    unsigned num_ids;    /* number of alloc/realloc ids */
+    unsigned num_ops;    /* number of distinct requests */
+    unsigned left;       /* requests the reader has yet to read */
+    off_t offset;        /* file offset of the next binary chunk */
+    traceop_t chunk[2][CHUNK_OPS]; /* the chunks being read and replayed */
+    unsigned count[2];   /* requests in each chunk; 0 after the last */
+    int full[2];         /* is the chunk waiting to be replayed? */
+    pthread_mutex_t lock;
+    pthread_cond_t cond; /* signalled when a chunk fills or empties */
+} stream_t;
+
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -82,15 +141,97 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double load_secs;    /* secs to read the trace into memory */
+    int binary;          /* was the trace in the binary format? */
+    double faults;   /* minor page faults in one run (only with -F) */
+    double secs_faults;  /* secs of that run, started on untouched pages */
+
+    /* defined only with -L */
+    double short_frac;   /* fraction of blocks that are short-lived */
+    double accuracy;     /* fraction of blocks the learned table predicts */
+    double util_learned; /* util with the learned lifetime table */
+    double util_hinted;  /* util with every block's actual lifetime */
+
+    /* defined only with -D */
+    double free_p99;     /* 99th percentile mm_free latency (secs) */
+    double free_p99_deferred; /* ... with a consolidator thread */
+    double util_deferred;     /* util with a consolidator thread */
+
+    /* defined only with -R */
+    double rss[2][NRSS]; /* RSS samples without and with decay (bytes) */
+
+    /* defined only with -A */
+    double secs_tagged;  /* secs to run the trace with mm_malloc_tagged */
+    int tags_ok;         /* did mm_tag_stats match the live blocks? */
+
+    /* defined only with -T */
+    double secs_threads1;   /* secs to replay the trace from one thread */
+    double secs_threads;    /* secs to replay nthreads copies at once */
+    double thread_secs_min; /* ... and the fastest thread's secs */
+    double thread_secs_max; /* ... and the slowest thread's secs */
+
+    /* defined only with -M */
+    int num_threads;     /* threads the trace's requests came from */
+    double remote_frees; /* frees on another thread than the allocation */
+    double waits;        /* requests that waited for another thread */
+    double secs_mt;      /* secs to replay from one thread per thread */
+
+    /* defined only with -S */
+    double wait_secs;    /* secs the replay waited for the reader */
+    double driver_bytes; /* driver memory for the requests and blocks */
+    double loaded_bytes; /* ... and what loading the trace would take */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* One thread's copy of a trace replayed from several threads (-T) */
+typedef struct {
+    trace_t *trace;            /* the trace, shared by the threads */
+    char **blocks;             /* this thread's blocks, by id */
+    pthread_barrier_t *start;  /* lets all the threads start at once */
+    struct timespec begin;     /* when this thread started replaying */
+    struct timespec end;       /* ... and when it was done */
+} replayer_t;
+
+/* One trace thread of a multi-threaded replay (-M) */
+typedef struct {
+    trace_t *trace;            /* the trace, shared by the threads */
+    unsigned *ops;             /* this thread's requests, in order... */
+    unsigned nops;             /* ... and how many there are */
+    unsigned *seq;             /* each request's number within its id */
+    _Atomic unsigned *done;    /* requests done on each id, by any thread */
+    char **blocks;             /* the blocks, by id, shared */
+    pthread_barrier_t *start;  /* lets all the threads start at once */
+    double waits;              /* requests that waited for another thread */
+    struct timespec begin;     /* when this thread started replaying */
+    struct timespec end;       /* ... and when it was done */
+} mtreplayer_t;
+
+/* What a worker sends back to mdriver for its trace (-j) */
+typedef struct {
+    stats_t stats;       /* the trace's stats */
+    int errors;          /* errors found while evaluating it */
+} result_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int fault_mode = 0; /* separate page fault time from mm time (-F) */
+static int lifetime_mode = 0; /* evaluate lifetime prediction (-L) */
+static int deferred_mode = 0; /* evaluate deferred coalescing (-D) */
+static int rss_mode = 0; /* report RSS over time with decay purging (-R) */
+static int tag_mode = 0; /* measure the cost of tagged allocation (-A) */
+static char *stats_name = NULL; /* shared memory object for mmstat (-s) */
+static int nthreads = 0; /* replay each trace from this many threads (-T) */
+static int mt_mode = 0; /* replay from each trace's own threads (-M) */
+static int stream_mode = 0; /* replay traces as they are read (-S) */
+static int jobs = 1;    /* traces evaluated at once in workers (-j, -J) */
+static int serial_timing = 0; /* time one worker at a time (-J) */
+static pthread_mutex_t *timing_lock; /* held by the worker being timed (-J) */
+static double synthetic_now; /* the decay clock during -R replays */
+static int util_hints = 0; /* eval_mm_util passes trace->hints to mm */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -114,7 +255,11 @@ static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static int map_trace(trace_t *trace, FILE *tracefile, char *path);
+static void check_ops(traceop_t *ops, unsigned n, unsigned num_ids,
+		      char *path);
 static void free_trace(trace_t *trace);
+static void printloads(int n, stats_t *stats);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
@@ -122,10 +267,61 @@ static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
+static void eval_mm_trace(char *filename, int tracenum, stats_t *stats);
+static void eval_mm_parallel(char **tracefiles, int n, stats_t *stats);
+static void timing_begin(void);
+static void timing_end(void);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
 
+/* Routines for separating page fault time from allocator time */
+static long minor_faults(void);
+static double fault_cost(void);
+static void printfaults(int n, stats_t *stats);
+
+/* Routines for evaluating lifetime-segregated allocation */
+static void eval_mm_lifetimes(trace_t *trace, int tracenum, range_t **ranges,
+			      stats_t *stats);
+static void printlifetimes(int n, stats_t *stats);
+
+/* Routines for evaluating deferred coalescing (-D) */
+static void eval_mm_deferred(trace_t *trace, stats_t *stats);
+static double replay_frees(trace_t *trace, int deferred, double *p99);
+static int cmp_double(const void *a, const void *b);
+static void printdeferred(int n, stats_t *stats);
+
+/* Routines for evaluating decay-based purging (-R) */
+static void eval_mm_rss(trace_t *trace, stats_t *stats);
+static void replay_rss(trace_t *trace, int decay, double *rss);
+static double synthetic_clock(void);
+static void printrss(int n, stats_t *stats);
+
+/* Routines for evaluating tagged allocation (-A) */
+static void eval_mm_tags(trace_t *trace, stats_t *stats);
+static void eval_mm_speed_tagged(void *ptr);
+static void printtags(int n, stats_t *stats);
+
+/* Routines for multi-threaded replay (-T) */
+static void eval_mm_threads(trace_t *trace, stats_t *stats);
+static double replay_threads(trace_t *trace, int n, double *min,
+			     double *max);
+static void *replay_thread(void *arg);
+static void printthreads(int n, stats_t *stats);
+
+/* Routines for replaying multi-threaded traces (-M) */
+static void eval_mm_mt(trace_t *trace, stats_t *stats);
+static double replay_mt(mtreplayer_t *replayers, unsigned n, double *waits);
+static void *mt_thread(void *arg);
+static void printmt(int n, stats_t *stats);
+
+/* Routines for streaming replay (-S) */
+static void eval_mm_stream(char *tracedir, char *filename, stats_t *stats);
+static void open_stream(stream_t *s, char *tracedir, char *filename);
+static void *stream_reader(void *arg);
+static unsigned read_chunk(stream_t *s, traceop_t *chunk);
+static void printstream(int n, stats_t *stats);
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
 static void usage(void);
@@ -143,7 +339,6 @@ int main(int argc, char **argv)
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
@@ -159,7 +354,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:j:J:s:t:T:hvVgalAFLDMRS")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -172,6 +367,18 @@ int main(int argc, char **argv)
             tracefiles[0] = strdup(optarg);
             tracefiles[1] = NULL;
             break;
+	case 'J': /* Like -j, but time one trace at a time */
+	    serial_timing = 1;
+	    /* fall through */
+	case 'j': /* Evaluate traces in parallel workers */
+	    if ((jobs = atoi(optarg)) < 1) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 's': /* Export mm statistics for mmstat */
+	    stats_name = optarg;
+	    break;
 	case 't': /* Directory where the traces are located */
 	    if (num_tracefiles == 1) /* ignore if -f already encountered */
 		break;
@@ -185,6 +392,33 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'F': /* Separate page fault time from allocator time */
+            fault_mode = 1;
+            break;
+        case 'L': /* Evaluate lifetime prediction */
+            lifetime_mode = 1;
+            break;
+        case 'D': /* Evaluate deferred coalescing */
+            deferred_mode = 1;
+            break;
+        case 'R': /* Report RSS over time with decay purging */
+            rss_mode = 1;
+            break;
+        case 'A': /* Measure the cost of tagged allocation */
+            tag_mode = 1;
+            break;
+        case 'T': /* Replay each trace from several threads */
+            if ((nthreads = atoi(optarg)) < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'M': /* Replay from each trace's own threads */
+            mt_mode = 1;
+            break;
+        case 'S': /* Replay traces as they are read */
+            stream_mode = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -280,39 +514,100 @@ int main(int argc, char **argv)
     if (verbose > 1)
 	printf("\nTesting mm malloc\n");
 
+    /* Workers would all write to one statistics page */
+    if (jobs > 1 && stats_name != NULL)
+	app_error("-s cannot be used with -j or -J");
+
     /* Allocate the mm stats array, with one stats_t struct per tracefile */
     mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
     
     /* Initialize the simulated memory system in memlib.c */
-    mem_init(); 
+    mem_init_size(HEAP_SIZE);
+
+    /* Optionally let mmstat watch the default heap through the runs */
+    if (stats_name != NULL &&
+	(mm_init() < 0 || mm_stats_export(stats_name) < 0))
+	unix_error("mm_stats_export failed in main");
+
+    /* With -S, replay each trace once as it streams in, and stop there */
+    if (stream_mode) {
+	for (i=0; i < num_tracefiles; i++)
+	    eval_mm_stream(tracedir, tracefiles[i], &mm_stats[i]);
+	if (stats_name != NULL)
+	    mm_stats_export(NULL);
+	printf("\nStreaming replay for mm malloc:\n");
+	printstream(num_tracefiles, mm_stats);
+	exit(0);
+    }
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
-    }
+    if (jobs > 1)
+	eval_mm_parallel(tracefiles, num_tracefiles, mm_stats);
+    else
+	for (i=0; i < num_tracefiles; i++)
+	    eval_mm_trace(tracefiles[i], i, &mm_stats[i]);
+    if (stats_name != NULL)
+	mm_stats_export(NULL);
 
     /* Display the mm results in a compact table */
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
+	printf("Trace loading:\n");
+	printloads(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the lifetime prediction results */
+    if (lifetime_mode) {
+	printf("Lifetime prediction for mm malloc:\n");
+	printlifetimes(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the deferred coalescing comparison */
+    if (deferred_mode) {
+	printf("Deferred coalescing for mm malloc:\n");
+	printdeferred(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display RSS over time */
+    if (rss_mode) {
+	printf("RSS over time for mm malloc (KB):\n");
+	printrss(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the cost of tagged allocation */
+    if (tag_mode) {
+	printf("Tagged allocation for mm malloc:\n");
+	printtags(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the multi-threaded scaling */
+    if (nthreads > 0) {
+	printf("Replay from %d threads for mm malloc:\n", nthreads);
+	printthreads(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the replays from each trace's own threads */
+    if (mt_mode) {
+	printf("Multi-threaded replay for mm malloc:\n");
+	printmt(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the page fault breakdown */
+    if (fault_mode) {
+	printf("Page faults for mm malloc:\n");
+	printfaults(num_tracefiles, mm_stats);
+	printf("\n");
     }
 
     /* 
@@ -436,12 +731,10 @@ static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
     range_t **prevpp = ranges;
-    int size;
 
     for (p = *ranges;  p != NULL; p = p->next) {
         if (p->lo == lo) {
 	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
             free(p);
             break;
         }
@@ -470,7 +763,8 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. A binary trace
+ *     (see trace.h) is mapped rather than read.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
@@ -478,7 +772,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index, size, thread;
     unsigned max_index = 0;
     unsigned op_index;
 
@@ -488,6 +782,9 @@ static trace_t *read_trace(char *tracedir, char *filename)
     /* Allocate the trace record */
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
+    trace->hints = NULL;
+    trace->threads = NULL;
+    trace->num_threads = 1;
 	
     /* Read the trace file header */
     strcpy(path, tracedir);
@@ -496,6 +793,11 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
+    trace->map = NULL;
+    if (map_trace(trace, tracefile, path)) {
+	fclose(tracefile);
+	return trace;
+    }
     fscanf(tracefile, "%u", &(trace->sugg_heapsize)); /* not used */
     fscanf(tracefile, "%u", &(trace->num_ids));     
     fscanf(tracefile, "%u", &(trace->num_ops));     
@@ -520,6 +822,22 @@ static trace_t *read_trace(char *tracedir, char *filename)
     index = 0;
     op_index = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
+	/* A thread id may come first, as in "t2 a 5 64"; the default is 0 */
+	if (type[0] == 't') {
+	    thread = (unsigned)atoi(type + 1);
+	    if (thread >= MAXTHREADS) {
+		sprintf(msg, "Thread id %u out of range in tracefile %s",
+			thread, path);
+		app_error(msg);
+	    }
+	    if (trace->threads == NULL && (trace->threads =
+		 (unsigned *)calloc(trace->num_ops, sizeof(unsigned))) == NULL)
+		unix_error("calloc failed in read_trace");
+	    trace->threads[op_index] = thread;
+	    if (thread >= trace->num_threads)
+		trace->num_threads = thread + 1;
+	    fscanf(tracefile, "%s", type);
+	}
 	switch(type[0]) {
 	case 'a':
 	    fscanf(tracefile, "%u %u", &index, &size);
@@ -555,15 +873,82 @@ static trace_t *read_trace(char *tracedir, char *filename)
     return trace;
 }
 
+/*
+ * map_trace - if tracefile is a binary trace, map its requests as
+ *     trace->ops, allocate the other arrays and return 1. Otherwise
+ *     rewind tracefile and return 0.
+ */
+static int map_trace(trace_t *trace, FILE *tracefile, char *path)
+{
+    tracehdr_t hdr;
+    struct stat st;
+    char *map;
+
+    if (fread(&hdr, sizeof(hdr), 1, tracefile) != 1 ||
+	memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0) {
+	rewind(tracefile);
+	return 0;
+    }
+    if (fstat(fileno(tracefile), &st) < 0 ||
+	(size_t)st.st_size != sizeof(hdr) + hdr.num_ops * sizeof(traceop_t)) {
+	sprintf(msg, "Truncated binary trace %s in read_trace", path);
+	app_error(msg);
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+	       fileno(tracefile), 0);
+    if (map == MAP_FAILED)
+	unix_error("mmap failed in read_trace");
+    trace->map = map;
+    trace->map_size = st.st_size;
+    trace->sugg_heapsize = hdr.sugg_heapsize;
+    trace->num_ids = hdr.num_ids;
+    trace->num_ops = hdr.num_ops;
+    trace->weight = hdr.weight;
+    trace->ops = (traceop_t *)(map + sizeof(hdr));
+    check_ops(trace->ops, trace->num_ops, trace->num_ids, path);
+
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
+    return 1;
+}
+
+/*
+ * check_ops - make sure that each of the n requests in ops has a valid
+ *     type, size and id, since the replays index their block tables with
+ *     the ids unchecked and a binary trace is used as it is read
+ */
+static void check_ops(traceop_t *ops, unsigned n, unsigned num_ids,
+		      char *path)
+{
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+	if ((ops[i].type != ALLOC && ops[i].type != FREE &&
+	     ops[i].type != REALLOC) || ops[i].size < 0 ||
+	    (unsigned)ops[i].index >= num_ids) {
+	    sprintf(msg, "Bad request %u in tracefile %s", i, path);
+	    app_error(msg);
+	}
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated or mapped in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* free the three arrays... */
+	munmap(trace->map, trace->map_size);
+    else
+	free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
+    free(trace->hints);
+    free(trace->threads);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -572,6 +957,181 @@ void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * eval_mm_trace - Read one trace and evaluate the mm malloc package on
+ *    it for correctness, efficiency and performance, along with any
+ *    optional evaluations that are enabled
+ */
+static void eval_mm_trace(char *filename, int tracenum, stats_t *stats)
+{
+    trace_t *trace;
+    range_t *ranges = NULL;    /* keeps track of block extents */
+    speed_t speed_params;      /* input parameters to eval_mm_speed */
+    struct timespec start, end;/* when the trace started and ended loading */
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    trace = read_trace(tracedir, filename);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stats->load_secs = (end.tv_sec - start.tv_sec) +
+	1e-9 * (end.tv_nsec - start.tv_nsec);
+    stats->binary = trace->map != NULL;
+    stats->ops = trace->num_ops;
+    stats->num_threads = trace->num_threads;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, &ranges);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	stats->util = eval_mm_util(trace, tracenum, &ranges);
+	if (lifetime_mode)
+	    eval_mm_lifetimes(trace, tracenum, &ranges, stats);
+	timing_begin();
+	if (deferred_mode)
+	    eval_mm_deferred(trace, stats);
+	if (rss_mode)
+	    eval_mm_rss(trace, stats);
+	if (tag_mode)
+	    eval_mm_tags(trace, stats);
+	if (nthreads > 0)
+	    eval_mm_threads(trace, stats);
+	if (mt_mode)
+	    eval_mm_mt(trace, stats);
+	speed_params.trace = trace;
+	speed_params.ranges = ranges;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	stats->secs = fsecs(eval_mm_speed, &speed_params);
+	/*
+	 * With -F, one more run starts on untouched pages, as in a new
+	 * process.  Dropping them is left out of both the timed runs.
+	 */
+	if (fault_mode) {
+	    mem_discard();
+	    stats->faults = minor_faults();
+	    clock_gettime(CLOCK_MONOTONIC, &start);
+	    eval_mm_speed(&speed_params);
+	    clock_gettime(CLOCK_MONOTONIC, &end);
+	    stats->faults = minor_faults() - stats->faults;
+	    stats->secs_faults = (end.tv_sec - start.tv_sec) +
+		1e-9 * (end.tv_nsec - start.tv_nsec);
+	}
+	timing_end();
+    }
+    clear_ranges(&ranges);
+    free_trace(trace);
+}
+
+/*
+ * eval_mm_parallel - Evaluate the traces in forked workers, one per
+ *    trace and up to "jobs" at a time, each with its own simulated
+ *    memory. Each worker writes its stats and error count back on a
+ *    pipe of its own; a worker that dies without doing so counts as
+ *    an invalid trace and an error.
+ */
+static void eval_mm_parallel(char **tracefiles, int n, stats_t *stats)
+{
+    result_t result;
+    pthread_mutexattr_t attr;
+    pid_t *pids, pid;
+    int *fds, fd[2];
+    int next, running, status, i;
+
+    if ((pids = (pid_t *)malloc(n * sizeof(pid_t))) == NULL ||
+	(fds = (int *)malloc(n * sizeof(int))) == NULL)
+	unix_error("malloc failed in eval_mm_parallel");
+
+    /*
+     * With -J, a lock shared by the workers serializes the timing.  It is
+     * robust, so that a worker that dies holding it does not leave the
+     * others waiting forever.
+     */
+    if (serial_timing) {
+	timing_lock = mmap(NULL, sizeof(pthread_mutex_t),
+			   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+			   -1, 0);
+	if (timing_lock == MAP_FAILED)
+	    unix_error("mmap failed in eval_mm_parallel");
+	if (pthread_mutexattr_init(&attr) != 0 ||
+	    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0 ||
+	    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) != 0 ||
+	    pthread_mutex_init(timing_lock, &attr) != 0)
+	    app_error("cannot create the timing lock in eval_mm_parallel");
+	pthread_mutexattr_destroy(&attr);
+    }
+
+    for (next = 0, running = 0; next < n || running > 0; running--) {
+	/* Keep up to "jobs" workers going */
+	for (; next < n && running < jobs; next++, running++) {
+	    if (pipe(fd) < 0)
+		unix_error("pipe failed in eval_mm_parallel");
+	    fflush(stdout);
+	    if ((pids[next] = fork()) < 0)
+		unix_error("fork failed in eval_mm_parallel");
+	    if (pids[next] == 0) {
+		close(fd[0]);
+		mem_deinit();
+		mem_init_size(HEAP_SIZE);
+		errors = 0;
+		memset(&result, 0, sizeof(result));
+		eval_mm_trace(tracefiles[next], next, &result.stats);
+		result.errors = errors;
+		if (write(fd[1], &result, sizeof(result)) != sizeof(result))
+		    unix_error("write failed in eval_mm_parallel");
+		fflush(stdout);
+		_exit(0);
+	    }
+	    close(fd[1]);
+	    fds[next] = fd[0];
+	}
+
+	/* Collect whichever worker finishes first */
+	if ((pid = wait(&status)) < 0)
+	    unix_error("wait failed in eval_mm_parallel");
+	for (i = 0; pids[i] != pid; i++)
+	    ;
+	if (read(fds[i], &result, sizeof(result)) == sizeof(result)) {
+	    stats[i] = result.stats;
+	    errors += result.errors;
+	} else {
+	    printf("ERROR [trace %d]: worker died (status 0x%x)\n", i, status);
+	    stats[i].valid = 0;
+	    errors++;
+	}
+	close(fds[i]);
+    }
+
+    if (serial_timing) {
+	pthread_mutex_destroy(timing_lock);
+	munmap(timing_lock, sizeof(pthread_mutex_t));
+    }
+    free(pids);
+    free(fds);
+}
+
+/*
+ * timing_begin, timing_end - with -J, bracket a worker's timed runs so
+ *     that only one worker is timed at a time
+ */
+static void timing_begin(void)
+{
+    int rc;
+
+    if (!serial_timing)
+	return;
+    /* The last worker to hold the lock died; its timing is over */
+    if ((rc = pthread_mutex_lock(timing_lock)) == EOWNERDEAD)
+	rc = pthread_mutex_consistent(timing_lock);
+    if (rc != 0)
+	app_error("cannot take the timing lock in timing_begin");
+}
+
+static void timing_end(void)
+{
+    if (serial_timing && pthread_mutex_unlock(timing_lock) != 0)
+	app_error("cannot release the timing lock in timing_end");
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
@@ -722,7 +1282,11 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if (util_hints)
+		p = mm_malloc_hint(size, trace->hints[i]);
+	    else
+		p = mm_malloc(size);
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -915,6 +1479,1141 @@ static void eval_libc_speed(void *ptr)
     }
 }
 
+/*******************************************************************
+ * The following routines evaluate lifetime-segregated allocation (-L)
+ ******************************************************************/
+
+/*
+ * eval_mm_lifetimes - Compute the actual lifetime of every block in the
+ *    trace from its alloc and free op indices, learn a size class to
+ *    lifetime table from them, and measure how well the table predicts
+ *    lifetimes and how much util it gains over no prediction and over
+ *    perfect prediction.
+ */
+static void eval_mm_lifetimes(trace_t *trace, int tracenum, range_t **ranges,
+			      stats_t *stats)
+{
+    int table[MM_NBINS];
+    int nshort[MM_NBINS], nlong[MM_NBINS];
+    unsigned *alloc_op;
+    unsigned i, index, lifetime;
+    unsigned nallocs = 0, nshorts = 0, ncorrect = 0;
+    int bin;
+
+    if ((trace->hints = (int *)calloc(trace->num_ops, sizeof(int))) == NULL)
+	unix_error("calloc 1 failed in eval_mm_lifetimes");
+    if ((alloc_op = (unsigned *)calloc(trace->num_ids, 
+				       sizeof(unsigned))) == NULL)
+	unix_error("calloc 2 failed in eval_mm_lifetimes");
+    for (bin = 0; bin < MM_NBINS; bin++)
+	nshort[bin] = nlong[bin] = 0;
+
+    /* 
+     * A block's lifetime is the number of ops from its malloc to its
+     * free. Blocks that are never freed live to the end of the trace.
+     */
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	if (trace->ops[i].type == ALLOC) {
+	    alloc_op[index] = i;
+	    trace->hints[i] = MM_HINT_LONG;
+	}
+	else if (trace->ops[i].type == FREE) {
+	    lifetime = i - alloc_op[index];
+	    if (lifetime < SHORT_LIFETIME * trace->num_ops)
+		trace->hints[alloc_op[index]] = MM_HINT_SHORT;
+	}
+    }
+
+    /* Learn the majority lifetime of each size class */
+    for (i = 0; i < trace->num_ops; i++) {
+	if (trace->ops[i].type != ALLOC)
+	    continue;
+	bin = mm_size_class(trace->ops[i].size);
+	if (trace->hints[i] == MM_HINT_SHORT)
+	    nshort[bin]++;
+	else
+	    nlong[bin]++;
+    }
+    for (bin = 0; bin < MM_NBINS; bin++)
+	table[bin] = (nshort[bin] > nlong[bin]) ? MM_HINT_SHORT : MM_HINT_LONG;
+
+    /* Score the table's predictions against the actual lifetimes */
+    for (i = 0; i < trace->num_ops; i++) {
+	if (trace->ops[i].type != ALLOC)
+	    continue;
+	nallocs++;
+	if (trace->hints[i] == MM_HINT_SHORT)
+	    nshorts++;
+	if (table[mm_size_class(trace->ops[i].size)] == trace->hints[i])
+	    ncorrect++;
+    }
+    stats->short_frac = (nallocs > 0) ? (double)nshorts / nallocs : 0;
+    stats->accuracy = (nallocs > 0) ? (double)ncorrect / nallocs : 0;
+
+    /* Measure util with the learned table and with perfect hints */
+    mm_set_lifetime_table(table);
+    stats->util_learned = eval_mm_util(trace, tracenum, ranges);
+    mm_set_lifetime_table(NULL);
+    util_hints = 1;
+    stats->util_hinted = eval_mm_util(trace, tracenum, ranges);
+    util_hints = 0;
+
+    free(alloc_op);
+}
+
+/*
+ * printlifetimes - print the results of eval_mm_lifetimes for each trace
+ */
+static void printlifetimes(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%8s%10s%7s%9s%8s\n",
+	   "trace", "short", "accuracy", "util", "learned", "hinted");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%11s%10s%7s%9s%8s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%10.0f%%%9.0f%%%6.0f%%%8.0f%%%7.0f%%\n",
+	       i,
+	       stats[i].short_frac * 100.0,
+	       stats[i].accuracy * 100.0,
+	       stats[i].util * 100.0,
+	       stats[i].util_learned * 100.0,
+	       stats[i].util_hinted * 100.0);
+    }
+}
+
+/*******************************************************************
+ * The following routines compare eager coalescing in mm_free with
+ * coalescing in a background consolidator thread (-D).
+ ******************************************************************/
+
+/*
+ * eval_mm_deferred - Measure free latency and util with and without
+ *    the consolidator thread
+ */
+static void eval_mm_deferred(trace_t *trace, stats_t *stats)
+{
+    replay_frees(trace, 0, &stats->free_p99);
+    stats->util_deferred = replay_frees(trace, 1, &stats->free_p99_deferred);
+}
+
+/*
+ * replay_frees - Run the trace once, timing every mm_free, with a
+ *    consolidator thread if "deferred" is set. Stores the 99th percentile
+ *    free latency in *p99 and returns the util, computed as in
+ *    eval_mm_util.
+ */
+static double replay_frees(trace_t *trace, int deferred, double *p99)
+{
+    struct timespec start, end;
+    double *lat;
+    unsigned i, nfrees = 0;
+    int index, size, total_size = 0, max_total_size = 0;
+    char *p;
+
+    if ((lat = (double *)malloc(trace->num_ops * sizeof(double))) == NULL)
+	unix_error("malloc failed in replay_frees");
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in replay_frees");
+    if (deferred && mm_consolidator_start() < 0)
+	app_error("mm_consolidator_start failed in replay_frees");
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+        case ALLOC:
+	    if ((p = mm_malloc(size)) == NULL)
+		app_error("mm_malloc failed in replay_frees");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    break;
+
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc failed in replay_frees");
+	    total_size += size - (int)trace->block_sizes[index];
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case FREE:
+	    clock_gettime(CLOCK_MONOTONIC, &start);
+	    mm_free(trace->blocks[index]);
+	    clock_gettime(CLOCK_MONOTONIC, &end);
+	    lat[nfrees++] = (end.tv_sec - start.tv_sec) +
+		1E-9*(end.tv_nsec - start.tv_nsec);
+	    total_size -= (int)trace->block_sizes[index];
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in replay_frees");
+        }
+	max_total_size = (total_size > max_total_size) ?
+	    total_size : max_total_size;
+    }
+    if (deferred)
+	mm_consolidator_stop();
+
+    qsort(lat, nfrees, sizeof(double), cmp_double);
+    *p99 = (nfrees > 0) ? lat[(nfrees - 1) * 99 / 100] : 0;
+    free(lat);
+    return ((double)max_total_size / (double)mem_heapsize());
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * printdeferred - print the results of eval_mm_deferred for each trace
+ */
+static void printdeferred(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%11s%11s%7s%11s\n",
+	   "trace", "p99 eager", "p99 defer", "util", "util defer");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%14s%11s%7s%11s\n", i, "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%11.0fns%9.0fns%6.0f%%%10.0f%%\n",
+	       i,
+	       stats[i].free_p99 * 1e9,
+	       stats[i].free_p99_deferred * 1e9,
+	       stats[i].util * 100.0,
+	       stats[i].util_deferred * 100.0);
+    }
+}
+
+/*******************************************************************
+ * The following routines replay traces on a synthetic clock and
+ * report how decay-based purging changes RSS over time (-R).
+ ******************************************************************/
+
+/*
+ * eval_mm_rss - Sample RSS over one replay without and one with decay
+ */
+static void eval_mm_rss(trace_t *trace, stats_t *stats)
+{
+    replay_rss(trace, 0, stats->rss[0]);
+    replay_rss(trace, 1, stats->rss[1]);
+}
+
+/*
+ * replay_rss - Run the trace once, OP_SECS of synthetic time per op,
+ *    with decay purging if "decay" is set, then idle for one decay time.
+ *    Stores NRSS samples of the heap's resident bytes in rss.
+ */
+static void replay_rss(trace_t *trace, int decay, double *rss)
+{
+    double decay_secs = DECAY_FRAC * trace->num_ops * OP_SECS;
+    unsigned i, index, size;
+    int sample = 0;
+    char *p;
+
+    /* Start every replay from an empty, non-resident heap */
+    mem_discard();
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in replay_rss");
+    synthetic_now = 0;
+    if (decay && mm_set_decay(decay_secs, synthetic_clock) < 0)
+	app_error("mm_set_decay failed in replay_rss");
+
+    for (i = 0; i < trace->num_ops; i++) {
+	synthetic_now += OP_SECS;
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+        case ALLOC:
+	    if ((p = mm_malloc(size)) == NULL)
+		app_error("mm_malloc failed in replay_rss");
+	    trace->blocks[index] = p;
+	    break;
+
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc failed in replay_rss");
+	    trace->blocks[index] = p;
+	    break;
+
+        case FREE:
+	    mm_free(trace->blocks[index]);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in replay_rss");
+        }
+	if ((i + 1) * RSS_RUN / trace->num_ops > (unsigned)sample)
+	    rss[sample++] = mem_resident();
+    }
+
+    /* Idle, letting the decay clock run */
+    for (i = 1; i <= RSS_IDLE; i++) {
+	synthetic_now += decay_secs / RSS_IDLE;
+	mm_decay();
+	rss[sample++] = mem_resident();
+    }
+    mm_set_decay(0, NULL);
+}
+
+/*
+ * synthetic_clock - the decay clock during -R replays
+ */
+static double synthetic_clock(void)
+{
+    return synthetic_now;
+}
+
+/*
+ * printrss - print the results of eval_mm_rss for each trace
+ */
+static void printrss(int n, stats_t *stats)
+{
+    int i, j, k;
+
+    printf("%5s%7s", "trace", "decay");
+    for (j = 1; j <= RSS_RUN; j++)
+	printf("%6d%%", 100 * j / RSS_RUN);
+    for (j = 1; j <= RSS_IDLE; j++)
+	printf("%6s%d", "idle", j);
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	for (k = 0; k < 2; k++) {
+	    if (k == 0)
+		printf("%2d", i);
+	    else
+		printf("%2s", "");
+	    printf("%10s", k ? "yes" : "no");
+	    for (j = 0; j < NRSS; j++) {
+		if (stats[i].valid)
+		    printf("%7.0f", stats[i].rss[k][j] / 1024);
+		else
+		    printf("%7s", "-");
+	    }
+	    printf("\n");
+	}
+    }
+}
+
+/*******************************************************************
+ * The following routines measure what mm_malloc_tagged and its
+ * per-tag statistics cost over plain mm_malloc (-A).
+ ******************************************************************/
+
+/*
+ * eval_mm_tags - Check the per-tag statistics after one tagged replay,
+ *    then time tagged replays as eval_mm_speed times untagged ones
+ */
+static void eval_mm_tags(trace_t *trace, stats_t *stats)
+{
+    speed_t speed_params;
+    size_t blocks[NTAGS + 1] = {0};
+    char *live;
+    unsigned i;
+    int tag;
+
+    /* Find the blocks still allocated at the end of the trace */
+    if ((live = (char *)calloc(trace->num_ids, 1)) == NULL)
+	unix_error("calloc failed in eval_mm_tags");
+    for (i = 0; i < trace->num_ops; i++)
+	live[trace->ops[i].index] = trace->ops[i].type != FREE;
+    for (i = 0; i < trace->num_ids; i++)
+	if (live[i])
+	    blocks[TAG_OF(i)]++;
+    free(live);
+
+    speed_params.trace = trace;
+    eval_mm_speed_tagged(&speed_params);
+    stats->tags_ok = 1;
+    for (tag = 1; tag <= NTAGS; tag++)
+	if (mm_tag_stats(tag).blocks != blocks[tag] ||
+	    (mm_tag_stats(tag).bytes == 0) != (blocks[tag] == 0))
+	    stats->tags_ok = 0;
+
+    stats->secs_tagged = fsecs(eval_mm_speed_tagged, &speed_params);
+}
+
+/*
+ * eval_mm_speed_tagged - eval_mm_speed with every block allocated by
+ *    mm_malloc_tagged, under one of NTAGS tags chosen by its id
+ */
+static void eval_mm_speed_tagged(void *ptr)
+{
+    unsigned i, index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_speed_tagged");
+
+    /* Interpret each trace request */
+    for (i = 0;  i < trace->num_ops;  i++)
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc_tagged */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_malloc_tagged(size, TAG_OF(index))) == NULL)
+		app_error("mm_malloc_tagged error in eval_mm_speed_tagged");
+            trace->blocks[index] = p;
+            break;
+
+	case REALLOC: /* mm_realloc */
+	    index = trace->ops[i].index;
+            newsize = trace->ops[i].size;
+	    oldp = trace->blocks[index];
+            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+		app_error("mm_realloc error in eval_mm_speed_tagged");
+            trace->blocks[index] = newp;
+            break;
+
+        case FREE: /* mm_free */
+            index = trace->ops[i].index;
+            block = trace->blocks[index];
+            mm_free(block);
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_speed_tagged");
+        }
+}
+
+/*
+ * printtags - print the results of eval_mm_tags for each trace
+ */
+static void printtags(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%10s%10s%10s%7s\n",
+	   "trace", "Kops", "Kops tag", "overhead", "stats");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%13s%10s%10s%7s\n", i, "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%13.0f%10.0f%9.1f%%%7s\n",
+	       i,
+	       stats[i].ops / 1e3 / stats[i].secs,
+	       stats[i].ops / 1e3 / stats[i].secs_tagged,
+	       (stats[i].secs_tagged / stats[i].secs - 1) * 100.0,
+	       stats[i].tags_ok ? "ok" : "wrong");
+    }
+}
+
+/*******************************************************************
+ * The following routines replay copies of a trace from several
+ * threads at once against the default heap, made thread-safe by
+ * per-thread caches, to measure how the allocator scales (-T).
+ ******************************************************************/
+
+/*
+ * eval_mm_threads - Time replays of the trace from one thread and then
+ *    from replay_threads threads, keeping the fastest of THREAD_RUNS
+ *    runs of each
+ */
+static void eval_mm_threads(trace_t *trace, stats_t *stats)
+{
+    double secs, min, max;
+    int run;
+
+    stats->secs_threads1 = stats->secs_threads = DBL_MAX;
+    for (run = 0; run < THREAD_RUNS; run++) {
+	secs = replay_threads(trace, 1, &min, &max);
+	if (secs < stats->secs_threads1)
+	    stats->secs_threads1 = secs;
+	secs = replay_threads(trace, nthreads, &min, &max);
+	if (secs < stats->secs_threads) {
+	    stats->secs_threads = secs;
+	    stats->thread_secs_min = min;
+	    stats->thread_secs_max = max;
+	}
+    }
+}
+
+/*
+ * replay_threads - replay the trace from n threads at once, each with
+ *    its own block ids, and return the secs from when the first started
+ *    until the last was done, along with the fastest and slowest
+ *    thread's secs
+ */
+static double replay_threads(trace_t *trace, int n, double *min,
+			     double *max)
+{
+    pthread_t *threads;
+    pthread_barrier_t start;
+    replayer_t *replayers;
+    double begin, end, b, e;
+    int i, err;
+
+    if ((threads = (pthread_t *)malloc(n * sizeof(pthread_t))) == NULL ||
+	(replayers = (replayer_t *)malloc(n * sizeof(replayer_t))) == NULL)
+	unix_error("malloc failed in replay_threads");
+
+    /* Reset the heap and initialize the mm package for threads */
+    mem_reset_brk();
+    if (mm_init() < 0 || mm_cache_enable(MM_CACHE_THREAD) < 0)
+	app_error("mm_init or mm_cache_enable failed in replay_threads");
+
+    pthread_barrier_init(&start, NULL, n + 1);
+    for (i = 0; i < n; i++) {
+	replayers[i].trace = trace;
+	replayers[i].start = &start;
+	if ((replayers[i].blocks =
+	     (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	    unix_error("malloc failed in replay_threads");
+	if ((err = pthread_create(&threads[i], NULL, replay_thread,
+				  &replayers[i])) != 0) {
+	    errno = err;
+	    unix_error("pthread_create failed in replay_threads");
+	}
+    }
+    pthread_barrier_wait(&start);
+    for (i = 0; i < n; i++)
+	pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&start);
+    mm_cache_enable(MM_CACHE_NONE);
+
+    begin = *min = DBL_MAX;
+    end = *max = 0;
+    for (i = 0; i < n; i++) {
+	b = replayers[i].begin.tv_sec + 1e-9 * replayers[i].begin.tv_nsec;
+	e = replayers[i].end.tv_sec + 1e-9 * replayers[i].end.tv_nsec;
+	if (b < begin)
+	    begin = b;
+	if (e > end)
+	    end = e;
+	if (e - b < *min)
+	    *min = e - b;
+	if (e - b > *max)
+	    *max = e - b;
+	free(replayers[i].blocks);
+    }
+    free(threads);
+    free(replayers);
+    return end - begin;
+}
+
+/*
+ * replay_thread - one thread of replay_threads: wait for the others,
+ *    then replay the whole trace and time it
+ */
+static void *replay_thread(void *arg)
+{
+    replayer_t *r = (replayer_t *)arg;
+    trace_t *trace = r->trace;
+    unsigned i, index;
+    char *p;
+
+    pthread_barrier_wait(r->start);
+    clock_gettime(CLOCK_MONOTONIC, &r->begin);
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC: /* mm_malloc */
+	    if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc error in replay_thread");
+	    r->blocks[index] = p;
+	    break;
+	case REALLOC: /* mm_realloc */
+	    if ((p = mm_realloc(r->blocks[index], trace->ops[i].size)) == NULL)
+		app_error("mm_realloc error in replay_thread");
+	    r->blocks[index] = p;
+	    break;
+	case FREE: /* mm_free */
+	    mm_free(r->blocks[index]);
+	    break;
+	default:
+	    app_error("Nonexistent request type in replay_thread");
+	}
+    }
+    clock_gettime(CLOCK_MONOTONIC, &r->end);
+    return NULL;
+}
+
+/*
+ * printthreads - print the results of eval_mm_threads for each trace
+ */
+static void printthreads(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%10s%10s%20s%12s\n", "trace", "Kops x1", "Kops xN",
+	   "Kops per thread", "efficiency");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%13s%10s%20s%12s\n", i, "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%13.0f%10.0f%9.0f -%9.0f%11.1f%%\n",
+	       i,
+	       stats[i].ops / 1e3 / stats[i].secs_threads1,
+	       nthreads * stats[i].ops / 1e3 / stats[i].secs_threads,
+	       stats[i].ops / 1e3 / stats[i].thread_secs_max,
+	       stats[i].ops / 1e3 / stats[i].thread_secs_min,
+	       100.0 * stats[i].secs_threads1 / stats[i].secs_threads);
+    }
+}
+
+/*******************************************************************
+ * The following routines replay a multi-threaded trace from one
+ * thread per trace thread, so that blocks are freed by other threads
+ * than the ones that allocated them, as in the traced program (-M).
+ ******************************************************************/
+
+/*
+ * eval_mm_mt - Replay the trace from one thread per trace thread,
+ *    keeping the fastest of THREAD_RUNS runs. Each request is numbered
+ *    within its id, and waits for that id's earlier requests, wherever
+ *    they run, rather than for the other threads as a whole.
+ */
+static void eval_mm_mt(trace_t *trace, stats_t *stats)
+{
+    mtreplayer_t *replayers;
+    unsigned *seq, *last, *owner, *next;
+    _Atomic unsigned *done;
+    unsigned i, t, index, n = trace->num_threads;
+    double secs, waits;
+    int run;
+
+    if ((seq = (unsigned *)malloc(trace->num_ops * sizeof(unsigned))) == NULL ||
+	(last = (unsigned *)calloc(trace->num_ids, sizeof(unsigned))) == NULL ||
+	(owner = (unsigned *)calloc(trace->num_ids, sizeof(unsigned))) == NULL ||
+	(next = (unsigned *)calloc(n, sizeof(unsigned))) == NULL ||
+	(done = (_Atomic unsigned *)malloc(trace->num_ids *
+					   sizeof(*done))) == NULL ||
+	(replayers = (mtreplayer_t *)calloc(n, sizeof(mtreplayer_t))) == NULL)
+	unix_error("malloc failed in eval_mm_mt");
+
+    /* Number the requests on each id, and split them up by thread */
+    stats->remote_frees = 0;
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	t = THREAD_OF(trace, i);
+	seq[i] = last[index]++;
+	if (trace->ops[i].type == FREE) {
+	    if (owner[index] != t)
+		stats->remote_frees++;
+	} else
+	    owner[index] = t;
+	replayers[t].nops++;
+    }
+    for (t = 0; t < n; t++)
+	if ((replayers[t].ops = (unsigned *)malloc(replayers[t].nops *
+						   sizeof(unsigned))) == NULL)
+	    unix_error("malloc failed in eval_mm_mt");
+    for (i = 0; i < trace->num_ops; i++) {
+	t = THREAD_OF(trace, i);
+	replayers[t].ops[next[t]++] = i;
+    }
+
+    stats->secs_mt = DBL_MAX;
+    for (run = 0; run < THREAD_RUNS; run++) {
+	for (i = 0; i < trace->num_ids; i++)
+	    atomic_init(&done[i], 0);
+	for (t = 0; t < n; t++) {
+	    replayers[t].trace = trace;
+	    replayers[t].seq = seq;
+	    replayers[t].done = done;
+	}
+	secs = replay_mt(replayers, n, &waits);
+	if (secs < stats->secs_mt) {
+	    stats->secs_mt = secs;
+	    stats->waits = waits;
+	}
+    }
+
+    for (t = 0; t < n; t++)
+	free(replayers[t].ops);
+    free(replayers);
+    free((void *)done);
+    free(next);
+    free(owner);
+    free(last);
+    free(seq);
+}
+
+/*
+ * replay_mt - start the n replayers at once against the default heap,
+ *    made thread-safe by per-thread caches, and return the secs from
+ *    when the first started until the last was done, along with the
+ *    number of requests that had to wait for another thread
+ */
+static double replay_mt(mtreplayer_t *replayers, unsigned n, double *waits)
+{
+    pthread_t *threads;
+    pthread_barrier_t start;
+    double begin, end, b, e;
+    unsigned t;
+    int err;
+
+    if ((threads = (pthread_t *)malloc(n * sizeof(pthread_t))) == NULL ||
+	(replayers[0].blocks = (char **)malloc(replayers[0].trace->num_ids *
+					       sizeof(char *))) == NULL)
+	unix_error("malloc failed in replay_mt");
+
+    /* Reset the heap and initialize the mm package for threads */
+    mem_reset_brk();
+    if (mm_init() < 0 || mm_cache_enable(MM_CACHE_THREAD) < 0)
+	app_error("mm_init or mm_cache_enable failed in replay_mt");
+
+    pthread_barrier_init(&start, NULL, n);
+    for (t = 0; t < n; t++) {
+	replayers[t].blocks = replayers[0].blocks;
+	replayers[t].start = &start;
+	if ((err = pthread_create(&threads[t], NULL, mt_thread,
+				  &replayers[t])) != 0) {
+	    errno = err;
+	    unix_error("pthread_create failed in replay_mt");
+	}
+    }
+    for (t = 0; t < n; t++)
+	pthread_join(threads[t], NULL);
+    pthread_barrier_destroy(&start);
+    mm_cache_enable(MM_CACHE_NONE);
+
+    begin = DBL_MAX;
+    end = 0;
+    *waits = 0;
+    for (t = 0; t < n; t++) {
+	b = replayers[t].begin.tv_sec + 1e-9 * replayers[t].begin.tv_nsec;
+	e = replayers[t].end.tv_sec + 1e-9 * replayers[t].end.tv_nsec;
+	if (b < begin)
+	    begin = b;
+	if (e > end)
+	    end = e;
+	*waits += replayers[t].waits;
+    }
+    free(replayers[0].blocks);
+    free(threads);
+    return end - begin;
+}
+
+/*
+ * mt_thread - one trace thread: replay its requests in order, waiting
+ *    before each one until the requests on the same id that come before
+ *    it in the trace are done
+ */
+static void *mt_thread(void *arg)
+{
+    mtreplayer_t *r = (mtreplayer_t *)arg;
+    trace_t *trace = r->trace;
+    unsigned i, k, index;
+    char *p;
+
+    r->waits = 0;
+    pthread_barrier_wait(r->start);
+    clock_gettime(CLOCK_MONOTONIC, &r->begin);
+    for (k = 0; k < r->nops; k++) {
+	i = r->ops[k];
+	index = trace->ops[i].index;
+	if (atomic_load_explicit(&r->done[index], memory_order_acquire) !=
+	    r->seq[i]) {
+	    r->waits++;
+	    while (atomic_load_explicit(&r->done[index],
+					memory_order_acquire) != r->seq[i])
+		sched_yield();
+	}
+	switch (trace->ops[i].type) {
+	case ALLOC: /* mm_malloc */
+	    if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc error in mt_thread");
+	    r->blocks[index] = p;
+	    break;
+	case REALLOC: /* mm_realloc */
+	    if ((p = mm_realloc(r->blocks[index], trace->ops[i].size)) == NULL)
+		app_error("mm_realloc error in mt_thread");
+	    r->blocks[index] = p;
+	    break;
+	case FREE: /* mm_free */
+	    mm_free(r->blocks[index]);
+	    break;
+	default:
+	    app_error("Nonexistent request type in mt_thread");
+	}
+	atomic_store_explicit(&r->done[index], r->seq[i] + 1,
+			      memory_order_release);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &r->end);
+    return NULL;
+}
+
+/*
+ * printmt - print the results of eval_mm_mt for each trace
+ */
+static void printmt(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%9s%13s%10s%10s%10s\n", "trace", "threads", "remote frees",
+	   "waits", "Kops", "Kops x1");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%12s%13s%10s%10s%10s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%12d%13.0f%10.0f%10.0f%10.0f\n",
+	       i,
+	       stats[i].num_threads,
+	       stats[i].remote_frees,
+	       stats[i].waits,
+	       stats[i].ops / 1e3 / stats[i].secs_mt,
+	       stats[i].ops / 1e3 / stats[i].secs);
+    }
+}
+
+/*******************************************************************
+ * The following routines replay a trace as it is read, in chunks,
+ * so that traces larger than memory can be replayed with little
+ * driver memory to disturb the allocator's cache behaviour (-S).
+ ******************************************************************/
+
+/*
+ * eval_mm_stream - Replay a trace once as a reader thread streams it in,
+ *    timing the replay and the time it spent waiting for the reader
+ */
+static void eval_mm_stream(char *tracedir, char *filename, stats_t *stats)
+{
+    stream_t *s;
+    pthread_t reader;
+    struct timespec start, end, wait_start, wait_end;
+    char **blocks, *p;
+    traceop_t *op;
+    unsigned i, n, index;
+    int b, err;
+
+    if ((s = (stream_t *)malloc(sizeof(stream_t))) == NULL)
+	unix_error("malloc failed in eval_mm_stream");
+    open_stream(s, tracedir, filename);
+    if ((blocks = (char **)calloc(s->num_ids, sizeof(char *))) == NULL)
+	unix_error("calloc failed in eval_mm_stream");
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_stream");
+
+    stats->wait_secs = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if ((err = pthread_create(&reader, NULL, stream_reader, s)) != 0) {
+	errno = err;
+	unix_error("pthread_create failed in eval_mm_stream");
+    }
+
+    /* Replay each chunk as it fills, handing it back to the reader */
+    for (b = 0; ; b ^= 1) {
+	pthread_mutex_lock(&s->lock);
+	if (!s->full[b]) {
+	    clock_gettime(CLOCK_MONOTONIC, &wait_start);
+	    while (!s->full[b])
+		pthread_cond_wait(&s->cond, &s->lock);
+	    clock_gettime(CLOCK_MONOTONIC, &wait_end);
+	    stats->wait_secs += (wait_end.tv_sec - wait_start.tv_sec) +
+		1e-9 * (wait_end.tv_nsec - wait_start.tv_nsec);
+	}
+	n = s->count[b];
+	pthread_mutex_unlock(&s->lock);
+	if (n == 0)
+	    break;
+
+	for (i = 0, op = s->chunk[b]; i < n; i++, op++) {
+	    index = op->index;
+	    switch (op->type) {
+	    case ALLOC: /* mm_malloc */
+		if ((p = mm_malloc(op->size)) == NULL)
+		    app_error("mm_malloc error in eval_mm_stream");
+		blocks[index] = p;
+		break;
+	    case REALLOC: /* mm_realloc */
+		if ((p = mm_realloc(blocks[index], op->size)) == NULL)
+		    app_error("mm_realloc error in eval_mm_stream");
+		blocks[index] = p;
+		break;
+	    case FREE: /* mm_free */
+		mm_free(blocks[index]);
+		break;
+	    default:
+		app_error("Nonexistent request type in eval_mm_stream");
+	    }
+	}
+
+	pthread_mutex_lock(&s->lock);
+	s->full[b] = 0;
+	pthread_cond_signal(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_join(reader, NULL);
+
+    stats->valid = 1;
+    stats->ops = s->num_ops;
+    stats->binary = s->file == NULL;
+    stats->secs = (end.tv_sec - start.tv_sec) +
+	1e-9 * (end.tv_nsec - start.tv_nsec);
+    stats->driver_bytes = sizeof(s->chunk) + s->num_ids * sizeof(char *);
+    stats->loaded_bytes = (double)s->num_ops * sizeof(traceop_t) +
+	s->num_ids * (sizeof(char *) + sizeof(size_t));
+
+    if (s->file != NULL)
+	fclose(s->file);
+    else
+	close(s->fd);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    free(s->path);
+    free(blocks);
+    free(s);
+}
+
+/*
+ * open_stream - open a trace and read its header, leaving s ready for
+ *     stream_reader. A binary trace (see trace.h) is read with read(2)
+ *     straight into the chunks; a text trace is parsed through stdio.
+ */
+static void open_stream(stream_t *s, char *tracedir, char *filename)
+{
+    tracehdr_t hdr;
+    char path[MAXLINE];
+    unsigned sugg_heapsize, weight;
+
+    if (verbose > 1)
+	printf("Streaming tracefile: %s\n", filename);
+
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((s->path = strdup(path)) == NULL)
+	unix_error("strdup failed in open_stream");
+    if ((s->fd = open(s->path, O_RDONLY)) < 0) {
+	sprintf(msg, "Could not open %s in open_stream", s->path);
+	unix_error(msg);
+    }
+    s->file = NULL;
+    if (read(s->fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+	memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) == 0) {
+	s->num_ids = hdr.num_ids;
+	s->num_ops = hdr.num_ops;
+	s->offset = sizeof(hdr);
+	/* The kernel reads ahead further for a file read straight through */
+	posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    } else {
+	if (lseek(s->fd, 0, SEEK_SET) < 0 ||
+	    (s->file = fdopen(s->fd, "r")) == NULL)
+	    unix_error("lseek or fdopen failed in open_stream");
+	if (fscanf(s->file, "%u %u %u %u", &sugg_heapsize, &s->num_ids,
+		   &s->num_ops, &weight) != 4) {
+	    sprintf(msg, "Bad header in tracefile %s", s->path);
+	    app_error(msg);
+	}
+    }
+    s->left = s->num_ops;
+    s->full[0] = s->full[1] = 0;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+}
+
+/*
+ * stream_reader - the reader thread: fill whichever chunk the replay has
+ *     emptied, until a chunk comes back empty at the end of the trace
+ */
+static void *stream_reader(void *arg)
+{
+    stream_t *s = (stream_t *)arg;
+    unsigned n;
+    int b = 0;
+
+    do {
+	pthread_mutex_lock(&s->lock);
+	while (s->full[b])
+	    pthread_cond_wait(&s->cond, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+
+	n = read_chunk(s, s->chunk[b]);
+
+	pthread_mutex_lock(&s->lock);
+	s->count[b] = n;
+	s->full[b] = 1;
+	pthread_cond_signal(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	b ^= 1;
+    } while (n > 0);
+    return NULL;
+}
+
+/*
+ * read_chunk - read up to CHUNK_OPS of the remaining requests into
+ *     chunk, checking their ids, and return how many were read
+ */
+static unsigned read_chunk(stream_t *s, traceop_t *chunk)
+{
+    unsigned i, n, index, size;
+    char type[MAXLINE];
+    size_t want, got;
+    ssize_t r;
+
+    n = s->left < CHUNK_OPS ? s->left : CHUNK_OPS;
+    if (s->file == NULL) {
+	/* Binary: the records are already laid out as the chunk is */
+	want = n * sizeof(traceop_t);
+	for (got = 0; got < want; got += r)
+	    if ((r = read(s->fd, (char *)chunk + got, want - got)) <= 0) {
+		sprintf(msg, "Truncated binary trace %s in read_chunk",
+			s->path);
+		app_error(msg);
+	    }
+	/* The pages just read will not be needed again */
+	posix_fadvise(s->fd, s->offset, want, POSIX_FADV_DONTNEED);
+	s->offset += want;
+    } else {
+	for (i = 0; i < n; i++) {
+	    size = 0;
+	    /* The replay is serial, so a thread id is skipped */
+	    if (fscanf(s->file, "%s", type) != 1 ||
+		(type[0] == 't' && fscanf(s->file, "%s", type) != 1) ||
+		fscanf(s->file, "%u", &index) != 1 ||
+		((type[0] == 'a' || type[0] == 'r') &&
+		 fscanf(s->file, "%u", &size) != 1)) {
+		sprintf(msg, "Truncated tracefile %s in read_chunk", s->path);
+		app_error(msg);
+	    }
+	    switch (type[0]) {
+	    case 'a': chunk[i].type = ALLOC; break;
+	    case 'r': chunk[i].type = REALLOC; break;
+	    case 'f': chunk[i].type = FREE; break;
+	    default:
+		printf("Bogus type character (%c) in tracefile %s\n",
+		       type[0], s->path);
+		exit(1);
+	    }
+	    chunk[i].index = index;
+	    chunk[i].size = size;
+	}
+    }
+    s->left -= n;
+    check_ops(chunk, n, s->num_ids, s->path);
+    return n;
+}
+
+/*
+ * printstream - print the results of eval_mm_stream for each trace
+ */
+static void printstream(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%8s%10s%10s%10s%10s%11s\n", "trace", "format", "ops",
+	   "Kops", "wait ms", "driver KB", "loaded KB");
+    for (i = 0; i < n; i++)
+	printf("%2d%11s%10.0f%10.0f%10.3f%10.0f%11.0f\n",
+	       i,
+	       stats[i].binary ? "binary" : "text",
+	       stats[i].ops,
+	       stats[i].ops / 1e3 / stats[i].secs,
+	       stats[i].wait_secs * 1e3,
+	       stats[i].driver_bytes / 1024,
+	       stats[i].loaded_bytes / 1024);
+}
+
+/*******************************************************************
+ * The following routines separate the time spent taking page faults
+ * from the time spent in the allocator itself (-F).
+ ******************************************************************/
+
+/*
+ * minor_faults - return the number of minor page faults taken so far
+ */
+static long minor_faults(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+	unix_error("getrusage failed in minor_faults");
+    return ru.ru_minflt;
+}
+
+/*
+ * fault_cost - estimate the time (in seconds) of one minor page fault
+ *    by first-touching freshly mapped pages. Takes the best of several
+ *    tries, like the K-best timing scheme.
+ */
+static double fault_cost(void)
+{
+    size_t pagesize = mem_pagesize();
+    size_t npages = 2048;
+    struct timeval stv, etv;
+    double secs, best = DBL_MAX;
+    long faults;
+    char *p;
+    size_t j;
+    int i;
+
+    for (i = 0; i < 5; i++) {
+	p = mmap(NULL, npages * pagesize, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	    unix_error("mmap failed in fault_cost");
+	faults = minor_faults();
+	gettimeofday(&stv, NULL);
+	for (j = 0; j < npages; j++)
+	    p[j * pagesize] = 1;
+	gettimeofday(&etv, NULL);
+	faults = minor_faults() - faults;
+	munmap(p, npages * pagesize);
+	secs = (etv.tv_sec - stv.tv_sec) + 1E-6*(etv.tv_usec - stv.tv_usec);
+	if (faults > 0 && secs / faults < best)
+	    best = secs / faults;
+    }
+    return (best == DBL_MAX) ? 0.0 : best;
+}
+
+/*
+ * printfaults - split each trace's run time into page fault time and
+ *     allocator time, using the measured cost of one fault
+ */
+static void printfaults(int n, stats_t *stats)
+{
+    double cost = fault_cost();
+    double fault_secs;
+    int i;
+
+    printf("(%.2f usecs per minor fault)\n", cost * 1e6);
+    printf("%5s%10s%12s%12s%8s\n",
+	   "trace", "faults", "fault secs", "mm secs", "fault%");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%13s%12s%12s%8s\n", i, "-", "-", "-", "-");
+	    continue;
+	}
+	fault_secs = stats[i].faults * cost;
+	if (fault_secs > stats[i].secs_faults)
+	    fault_secs = stats[i].secs_faults;
+	printf("%2d%13.0f%12.6f%12.6f%7.0f%%\n",
+	       i,
+	       stats[i].faults,
+	       fault_secs,
+	       stats[i].secs_faults - fault_secs,
+	       (stats[i].secs_faults > 0) ?
+	       100.0 * fault_secs / stats[i].secs_faults : 0.0);
+    }
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
@@ -1006,19 +2705,48 @@ void malloc_error(int tracenum, int opnum, char *msg)
     printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
+/*
+ * printloads - print how long each trace took to load, and in what format
+ */
+static void printloads(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%8s%10s%10s%9s\n", "trace", "format", "ops", "msecs",
+	   "ns/op");
+    for (i = 0; i < n; i++)
+	printf("%2d%11s%10.0f%10.3f%9.1f\n",
+	       i,
+	       stats[i].binary ? "binary" : "text",
+	       stats[i].ops,
+	       stats[i].load_secs * 1e3,
+	       stats[i].load_secs * 1e9 / stats[i].ops);
+}
+
 /* 
  * usage - Explain the command line arguments
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValAFLDMRS] [-f <file>] [-j <n>] [-J <n>] [-s <name>] [-t <dir>] [-T <n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A         Measure the cost of tagged allocation.\n");
+    fprintf(stderr, "\t-D         Compare deferred and eager coalescing.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F         Separate page fault time from mm time.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to <n> traces at once.\n");
+    fprintf(stderr, "\t-J <n>     As -j, but time one trace at a time.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Evaluate lifetime-segregated allocation.\n");
+    fprintf(stderr, "\t-M         Replay from one thread per trace thread.\n");
+    fprintf(stderr, "\t-R         Report RSS over time with decay purging.\n");
+    fprintf(stderr, "\t-S         Replay traces as they are read, in chunks.\n");
+    fprintf(stderr, "\t-s <name>  Export mm statistics for mmstat to <name>.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Replay each trace from <n> threads at once.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -5,33 +5,65 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* The state of one simulated heap */
+struct mem_region {
+    char *start_brk;  /* points to first byte of heap */
+    char *brk;        /* points to last byte of heap */
+    char *max_addr;   /* largest legal heap address */ 
+};
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static struct mem_region mem_default;  /* the region used by mem_* */
+
+/*
+ * mem_region_init - map max_size bytes of storage for a region. The
+ *    storage is page-aligned and is only backed by memory once touched.
+ */
+static int mem_region_init(mem_region_t *region, size_t max_size)
+{
+    void *start;
+
+    start = mmap(NULL, max_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (start == MAP_FAILED)
+	return -1;
+    region->start_brk = (char *)start;
+    region->max_addr = region->start_brk + max_size; /* max legal address */
+    region->brk = region->start_brk;                 /* empty initially */
+    return 0;
+}
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
+{
+    mem_init_size(MAX_HEAP);
+}
+
+/*
+ * mem_init_size - initialize the memory system model with room for a
+ *    heap of up to max_size bytes
+ */
+void mem_init_size(size_t max_size)
 {
     /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    if (mem_region_init(&mem_default, max_size) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
 /* 
@@ -39,7 +71,7 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    munmap(mem_default.start_brk, mem_default.max_addr - mem_default.start_brk);
 }
 
 /*
@@ -47,7 +79,7 @@ void mem_deinit(void)
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_region_reset_brk(&mem_default);
 }
 
 /* 
@@ -57,15 +89,7 @@ void mem_reset_brk()
  */
 void *mem_sbrk(intptr_t incr) 
 {
-    char *old_brk = mem_brk;
-
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
-    }
-    mem_brk += incr;
-    return (void *)old_brk;
+    return mem_region_sbrk(&mem_default, incr);
 }
 
 /*
@@ -73,7 +97,7 @@ void *mem_sbrk(intptr_t incr)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_region_lo(&mem_default);
 }
 
 /* 
@@ -81,7 +105,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_region_hi(&mem_default);
 }
 
 /*
@@ -89,7 +113,7 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_region_size(&mem_default);
 }
 
 /*
@@ -99,3 +123,230 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_prefault - fault in the pages in [lo, lo + len) so that the first
+ *    real use of them does not take a page fault. A page that lo is not
+ *    at the start of is left alone, since the bytes below lo may be in
+ *    use. Where MADV_POPULATE_WRITE is not available, each page is
+ *    touched by writing back one of its bytes, so no other thread may be
+ *    using the pages.
+ */
+void mem_prefault(void *lo, size_t len)
+{
+    size_t pagesize = mem_pagesize();
+    char *p = (char *)(((uintptr_t)lo + pagesize - 1) & ~(pagesize - 1));
+    char *hi = (char *)lo + len;
+
+    if (p >= hi)
+	return;
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(p, hi - p, MADV_POPULATE_WRITE) == 0)
+	return;
+#endif
+    for (; p < hi; p += pagesize)
+	*(volatile char *)p = *(volatile char *)p;
+}
+
+/*
+ * mem_purge - give the pages in [lo, lo + len) back to the system; both
+ *    ends must be page-aligned. The pages read as zeros afterwards.
+ */
+void mem_purge(void *lo, size_t len)
+{
+    if (len > 0)
+	madvise(lo, len, MADV_DONTNEED);
+}
+
+/*
+ * mem_discard - give the pages of the default heap back to the system
+ *    without moving brk, so that the next touch of each page faults
+ */
+void mem_discard(void)
+{
+    mem_region_discard(&mem_default);
+}
+
+/*
+ * mem_resident - returns the bytes of the default heap backed by memory
+ */
+size_t mem_resident(void)
+{
+    return mem_region_resident(&mem_default);
+}
+
+/*
+ * mem_default_region - return the region that the mem_* functions use
+ */
+mem_region_t *mem_default_region(void)
+{
+    return &mem_default;
+}
+
+/*
+ * mem_region_create - create a new, empty region that can grow to
+ *    max_size bytes. Returns NULL if the storage cannot be allocated.
+ */
+mem_region_t *mem_region_create(size_t max_size)
+{
+    mem_region_t *region;
+
+    if ((region = (mem_region_t *)malloc(sizeof(mem_region_t))) == NULL)
+	return NULL;
+    if (mem_region_init(region, max_size) < 0) {
+	free(region);
+	return NULL;
+    }
+    return region;
+}
+
+/*
+ * mem_region_destroy - release a region and all of the storage in it
+ */
+void mem_region_destroy(mem_region_t *region)
+{
+    munmap(region->start_brk, region->max_addr - region->start_brk);
+    free(region);
+}
+
+/*
+ * mem_region_sbrk - mem_sbrk for an explicit region
+ */
+void *mem_region_sbrk(mem_region_t *region, intptr_t incr)
+{
+    char *old_brk = region->brk;
+
+    if ( (incr < 0) || ((region->brk + incr) > region->max_addr)) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    region->brk += incr;
+    return (void *)old_brk;
+}
+
+/*
+ * mem_region_reset_brk - mem_reset_brk for an explicit region
+ */
+void mem_region_reset_brk(mem_region_t *region)
+{
+    region->brk = region->start_brk;
+}
+
+/*
+ * mem_region_lo - return address of the first byte of a region's heap
+ */
+void *mem_region_lo(mem_region_t *region)
+{
+    return (void *)region->start_brk;
+}
+
+/*
+ * mem_region_hi - return address of the last byte of a region's heap
+ */
+void *mem_region_hi(mem_region_t *region)
+{
+    return (void *)(region->brk - 1);
+}
+
+/*
+ * mem_region_size - returns the size of a region's heap in bytes
+ */
+size_t mem_region_size(mem_region_t *region)
+{
+    return (size_t)(region->brk - region->start_brk);
+}
+
+/*
+ * mem_region_discard - mem_discard for an explicit region
+ */
+void mem_region_discard(mem_region_t *region)
+{
+    size_t pagesize = mem_pagesize();
+    size_t len = region->brk - region->start_brk;
+
+    len = (len + pagesize - 1) & ~(pagesize - 1);
+    if (len > 0)
+	madvise(region->start_brk, len, MADV_DONTNEED);
+}
+
+/*
+ * mem_region_maxsize - returns the most bytes a region's heap can hold
+ */
+size_t mem_region_maxsize(mem_region_t *region)
+{
+    return (size_t)(region->max_addr - region->start_brk);
+}
+
+/*
+ * mem_region_resident - mem_resident for an explicit region
+ */
+size_t mem_region_resident(mem_region_t *region)
+{
+    size_t pagesize = mem_pagesize();
+    size_t npages = (region->brk - region->start_brk + pagesize - 1) /
+	pagesize;
+    unsigned char *vec;
+    size_t i, resident = 0;
+
+    if (npages == 0)
+	return 0;
+    if ((vec = (unsigned char *)malloc(npages)) == NULL)
+	return 0;
+    if (mincore(region->start_brk, npages * pagesize, vec) == 0) {
+	for (i = 0; i < npages; i++)
+	    resident += vec[i] & 1;
+    }
+    free(vec);
+    return resident * pagesize;
+}
+
+/*
+ * mem_shared_create - create the POSIX shared memory object "name" with
+ *    size zeroed bytes, replacing any old one, and map it. Returns its
+ *    address, or NULL if it cannot be created.
+ */
+void *mem_shared_create(const char *name, size_t size)
+{
+    void *ptr = MAP_FAILED;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+	return NULL;
+    if (ftruncate(fd, size) == 0)
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+	shm_unlink(name);
+	return NULL;
+    }
+    return ptr;
+}
+
+/*
+ * mem_shared_attach - map the first size bytes of the existing shared
+ *    memory object "name" read-only. Returns NULL if it cannot be mapped.
+ */
+void *mem_shared_attach(const char *name, size_t size)
+{
+    struct stat st;
+    void *ptr = MAP_FAILED;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+	return NULL;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= size)
+	ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/*
+ * mem_shared_destroy - unmap an object made by mem_shared_create and
+ *    remove its name
+ */
+void mem_shared_destroy(const char *name, void *ptr, size_t size)
+{
+    munmap(ptr, size);
+    shm_unlink(name);
+}
@@ -1,4 +1,14 @@
+/*
+ * A mem_region_t models one process's heap: a fixed block of storage
+ * with a brk pointer.  The mem_* functions act on a default region that
+ * mem_init() sets up; the mem_region_* functions act on an explicit one,
+ * so that several independent heaps can exist at the same time.  Region
+ * storage is mmap()ed, so the first byte of every region is page-aligned.
+ */
+typedef struct mem_region mem_region_t;
+
 void mem_init(void);               
+void mem_init_size(size_t max_size);
 void mem_deinit(void);
 void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void); 
@@ -6,3 +16,27 @@ void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+void mem_prefault(void *lo, size_t len);
+void mem_purge(void *lo, size_t len);
+void mem_discard(void);
+size_t mem_resident(void);
+
+mem_region_t *mem_default_region(void);
+mem_region_t *mem_region_create(size_t max_size);
+void mem_region_destroy(mem_region_t *region);
+void *mem_region_sbrk(mem_region_t *region, intptr_t incr);
+void mem_region_reset_brk(mem_region_t *region);
+void *mem_region_lo(mem_region_t *region);
+void *mem_region_hi(mem_region_t *region);
+size_t mem_region_size(mem_region_t *region);
+size_t mem_region_maxsize(mem_region_t *region);
+void mem_region_discard(mem_region_t *region);
+size_t mem_region_resident(mem_region_t *region);
+
+/*
+ * Named shared memory objects, e.g., for handing statistics to another
+ * process.  mem_shared_attach() maps an existing object read-only.
+ */
+void *mem_shared_create(const char *name, size_t size);
+void *mem_shared_attach(const char *name, size_t size);
+void mem_shared_destroy(const char *name, void *ptr, size_t size);
@@ -1,11 +1,30 @@
-/* 
- * Simple, 32-bit and 64-bit clean allocator based on an implicit free list,
- * first fit placement, and boundary tag coalescing, as described in the
- * CS:APP2e text.  Blocks are aligned to double-word boundaries.  This
- * yields 8-byte aligned blocks on a 32-bit processor, and 16-byte aligned
- * blocks on a 64-bit processor.  However, 16-byte alignment is stricter
- * than necessary; the assignment only requires 8-byte alignment.  The
- * minimum block size is four words.
+/*
+ * Simple, 32-bit and 64-bit clean allocator based on segregated explicit
+ * free lists, first fit placement within a size class, and boundary tag
+ * coalescing, as described in the CS:APP2e text.  Blocks are aligned to
+ * ASIZE (8) byte boundaries, which is what the assignment requires.
+ *
+ * Every block carries a one word header and a one word footer.  A free
+ * block additionally stores a "struct node" at the start of its payload
+ * that links it into the doubly-linked, NULL-terminated free list of its
+ * size class.  The size classes are given by MM_BIN_LIMITS in mm.h so
+ * that callers can compute a block's class at compile time.
+ *
+ * Requests for at most TINYMAX bytes are instead packed into "tiny pages",
+ * page-aligned allocated blocks of exactly one page that are cut into
+ * slots of one size with no tags at all.  A bitmap at the start of each
+ * tiny page marks its free slots, and a map with a byte per page of the
+ * heap tells mm_free() whether a block is in a tiny page.
+ *
+ * The free block at the end of the heap, the "top", is on no free list.
+ * It serves requests that no free block fits, and a block freed next to
+ * it merges into it, so that allocating and freeing in stack order just
+ * moves the start of the top up and down.
+ *
+ * With MM_INDEX, every free list is mirrored by a side index holding the
+ * sizes and offsets of its blocks in two packed arrays, and find_fit()
+ * scans the sizes array with SIMD compares instead of following the
+ * links from block to block.
  *
  * This allocator uses the size of a pointer, e.g., sizeof(void *), to
  * define the size of a word.  This allocator also uses the standard
@@ -13,13 +32,33 @@
  * as a pointer, i.e., sizeof(uintptr_t) == sizeof(void *).
  */
 
+#define _GNU_SOURCE		/* For sched_getcpu() */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef MM_HARDENED
+#include <sys/random.h>
+#endif
+#if defined(MM_INDEX) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+#if defined(__has_include) && __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define HAVE_RSEQ
+#endif
 
 #include "memlib.h"
 #include "mm.h"
+#include "mmstat.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -39,76 +78,438 @@ team_t team = {
 };
 
 /* Basic constants and macros: */
-#define ASIZE	   8		  	  /* Number of bytes to align to */
+#define ASIZE	   MM_ALIGN	  /* Number of bytes to align to */
 #define WSIZE      sizeof(void *) /* Word and header/footer size (bytes) */
 #define DSIZE      (2 * WSIZE)    /* Doubleword size (bytes) */
-#define QSIZE	   (4 * WSIZE)	  /* Quadword size (bytes) */
+#define QSIZE	   MM_OVERHEAD	  /* Quadword size (bytes) */
 #define CHUNKSIZE  (1 << 12)      /* Extend heap by this amount (bytes) */
-
-#define MAX(x, y)  ((x) > (y) ? (x) : (y))  
+#define NBINS      MM_NBINS       /* Number of segregated free lists */
+#define LIFE_LONG  0              /* Block predicted to live long */
+#define LIFE_SHORT 1              /* Block predicted to die soon */
+#define NLIFE      2              /* Number of lifetime classes */
+#define PAGEHEAPSIZE (64 * (1 << 20)) /* Most bytes the page sub-heap holds */
+#define NEARPAGES  4              /* Pages after a hint searched for a fit */
+#define DEFERBATCH 64             /* Frees consolidated per lock hold */
+#define DEFERNAP   100000         /* Consolidator's idle sleep (ns) */
+#define NEPOCHS    32             /* Decay epochs per decay time */
+#define NCLASSES   11             /* Block sizes held by front-end caches */
+#define CACHESLOTS 64             /* Blocks a cache holds of each size */
+#define CACHEBATCH 32             /* Blocks moved per refill or flush */
+#define XFERBATCHES 16            /* Batches a transfer cache holds */
+#define TINYMAX    MM_TINYMAX     /* Largest request packed in tiny pages */
+#define NTINY      2              /* Tiny slot sizes: 8 and 16 bytes */
+#define CACHELINE  64             /* Bytes per cache line */
+#define TINYCOLOURS 4             /* Cache lines tiny slots rotate over */
+#define STATSOPS   64             /* Requests between statistics updates */
+
+/* States of a page in the dirty map. */
+#define PAGE_USED  0              /* In or next to an allocated block */
+#define PAGE_DIRTY 1              /* Inside a free block, still backed */
+#define PAGE_CLEAN 2              /* Inside a free block, purged or new */
+
+#define MAX(x, y)  ((x) > (y) ? (x) : (y))
+#define MIN(x, y)  ((x) < (y) ? (x) : (y))
 
 /* Pack a size and allocated bit into a word. */
 #define PACK(size, alloc)  ((size) | (alloc))
 
+/* Pack a size, allocated bit and lifetime class into a word. */
+#define PACK_LIFE(size, alloc, life)  ((size) | (alloc) | ((life) << 1))
+
+/*
+ * With MM_HARDENED, every boundary tag carries a checksum of its value,
+ * its address and a per-process secret in its top byte, and both free
+ * list links are stored XORed with their own address and the secret
+ * ("safe-linking").  Unlinking a block checks both of its neighbours'
+ * links, so a forged link is caught before the block it leads to is
+ * handed out.  MM_HARDENED_FAST leaves the "next" links plain, since
+ * unmangling them lengthens every step of a free list search, at several
+ * times the cost of the rest of hardened mode.  A block held by a front-end
+ * cache, which the heap still counts as allocated, carries CACHE_MARK()
+ * in its first word, so that freeing it again is caught.  The mark is
+ * kept out of the tags, which the heap may read while the block is
+ * cached.
+ */
+#ifdef MM_HARDENED
+#if UINTPTR_MAX <= 0xffffffff
+#error "MM_HARDENED needs 64-bit boundary tags"
+#endif
+#define TAG_MASK  (((uintptr_t)1 << 56) - 1)
+#define CHECKSUM(p, val)  ((((uintptr_t)(p) ^ (uintptr_t)(val) ^ \
+	mm_secret) * 0x9e3779b97f4a7c15u) & ~TAG_MASK)
+#define MANGLE(pos, ptr)  ((struct node *)((uintptr_t)(ptr) ^ \
+	((uintptr_t)(pos) >> 12) ^ mm_secret))
+#define CACHE_MARK(bp)  (((uintptr_t)(bp) ^ mm_secret) * 0x9e3779b97f4a7c15u)
+#ifdef MM_HARDENED_FAST
+#define MANGLE_NEXT(pos, ptr)  (ptr)
+#else
+#define MANGLE_NEXT(pos, ptr)  MANGLE(pos, ptr)
+#endif
+#else
+#define TAG_MASK  (~(uintptr_t)0)
+#define CHECKSUM(p, val)  ((uintptr_t)0)
+#define MANGLE(pos, ptr)  (ptr)
+#define MANGLE_NEXT(pos, ptr)  (ptr)
+#endif
+
 /* Read and write a word at address p. */
 #define GET(p)       (*(uintptr_t *)(p))
-#define PUT(p, val)  (*(uintptr_t *)(p) = (val))
+#define PUT(p, val)  (*(uintptr_t *)(p) = (val) | CHECKSUM(p, val))
+
+/* Read a boundary tag without its checksum, and check its checksum. */
+#define GET_TAG(p)   (GET(p) & TAG_MASK)
+#define TAG_OK(p)    (GET(p) == (GET_TAG(p) | CHECKSUM(p, GET_TAG(p))))
+
+/*
+ * On 64-bit machines, bits 48 to 55 of an allocated block's tags hold the
+ * block's owner, the tag given to mm_malloc_tagged(), or 0.
+ */
+#if UINTPTR_MAX > 0xffffffff
+#define SIZE_MASK  (((uintptr_t)1 << 48) - 1)
+#define PACK_OWNER(owner)  ((uintptr_t)(owner) << 48)
+#define GET_OWNER(p)  ((int)(GET(p) >> 48) & (MM_NTAGS - 1))
+#else
+#define SIZE_MASK  (~(uintptr_t)0)
+#define PACK_OWNER(owner)  ((uintptr_t)0)
+#define GET_OWNER(p)  0
+#endif
 
 /* Read the size and allocated fields from address p. */
-#define GET_SIZE(p)   (GET(p) & ~(ASIZE - 1))
+#define GET_SIZE(p)   (GET(p) & SIZE_MASK & ~(uintptr_t)(ASIZE - 1))
 #define GET_ALLOC(p)  (GET(p) & 0x1)
+#define GET_LIFE(p)   ((int)(GET(p) >> 1) & 0x1)
 
 /* Given block ptr bp, compute address of its header and footer. */
 #define HDRP(bp)  ((char *)(bp) - WSIZE)
 #define FTRP(bp)  ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
 /* Given block ptr bp, compute address of next and previous blocks. */
-#define NEXT_BLKP(bp) ((char *)(GET((char *)(HDRP(bp) +  WSIZE))))
-#define PREV_BLKP(bp) ((char *)(GET((char *)(HDRP(bp) + 2 * WSIZE))))
-
 #define NEXT_PHYS_BLKP(bp) ((char *)(FTRP(bp) + 2 * WSIZE))
-#define PREV_PHYS_BLKP(bp) ((char *)(bp - (GET_SIZE(bp - 2 * WSIZE))))
-
-/* Given block ptr bp, put a pointer into it to the next block in list. */
-#define SET_NEXT(bp, bp2) (PUT(bp, (uint64_t)bp2))
-
-/* Given block ptr bp, put pointer in adjacent block to the previous block */
-#define SET_PREV(bp, bp2) (PUT(bp + WSIZE, (uint64_t)bp2))
-
-/* Given bin number, compute distance from heap_listp to bin*/
-#define BIN_DIST(num) ((num + 1) * WSIZE)
+#define PREV_PHYS_BLKP(bp) \
+	((char *)(bp) - GET_SIZE((char *)(bp) - 2 * WSIZE))
 
 struct node {
 	struct node *next;
 	struct node *previous;
+#ifdef MM_INDEX
+	size_t slot;              /* Position in the side index */
+#endif
+};
+
+#ifdef MM_INDEX
+/*
+ * The side index of one free list: the size of each block, saturated at
+ * UINT32_MAX, and its offset from heap_listp in units of ASIZE.
+ */
+struct fit_index {
+	uint32_t *sizes;
+	uint32_t *offsets;
+	size_t n;                 /* Blocks in the index */
+	size_t max;               /* Room in the arrays */
+};
+#endif
+
+/* Read and write the links of the free list node n. */
+#define NEXT(n)          MANGLE_NEXT(&(n)->next, (n)->next)
+#define PREV(n)          MANGLE(&(n)->previous, (n)->previous)
+#define SET_NEXT(n, ptr) ((n)->next = MANGLE_NEXT(&(n)->next, ptr))
+#define SET_PREV(n, ptr) ((n)->previous = MANGLE(&(n)->previous, ptr))
+
+/* Could the link ptr, once demangled, lead to a node in [lo, hi)? */
+#define LINK_OK(lo, hi, ptr)  ((ptr) == NULL || \
+	((uintptr_t)(ptr) % ASIZE == 0 && (char *)(ptr) > (lo) && \
+	(char *)(ptr) < (hi)))
+
+/*
+ * The state of one heap.  The default heap used by mm_malloc() and friends
+ * lives in static storage; every other heap keeps its mm_heap at the start
+ * of its own memlib region.
+ */
+struct mm_heap {
+	char *heap_listp;                /* Pointer to first block */
+	char *top;                       /* Free block at the end, or NULL */
+	char *limit;                     /* End of the heap's region */
+	struct node *list_start[NLIFE][NBINS]; /* Head of each free list */
+	mem_region_t *region;            /* Where this heap's memory comes from */
+#ifdef MM_INDEX
+	struct fit_index index[NLIFE][NBINS]; /* Mirror of each free list */
+	bool index_ok;                   /* False once the index ran out of memory */
+#endif
+
+	/*
+	 * Built on the first mm_malloc_near() and kept up to date from then
+	 * on: the number of free blocks whose payload starts in each page.
+	 */
+	unsigned short *near_map;
+	size_t pagesize;
+
+	/*
+	 * Whether each page is a tiny page, and the tiny pages with free
+	 * slots of each owner and size.  Successive tiny pages of one size
+	 * start their slots 0 to TINYCOLOURS - 1 cache lines after the header.
+	 */
+	unsigned char *tiny_map;
+	struct tiny_page *tiny_pages[MM_NTAGS][NTINY];
+	unsigned int tiny_colour[NTINY];     /* Colour of the next tiny page */
+
+	/*
+	 * Set up by mm_heap_set_decay().  The state of each page, and the
+	 * number of pages made dirty in each of the last NEPOCHS epochs of
+	 * decay_secs / NEPOCHS seconds, the current one being "epoch".
+	 */
+	unsigned char *dirty_map;
+	double decay_secs;
+	double (*clock)(void);
+	double epoch_start;
+	int epoch;
+	size_t ndirty;
+	size_t dirtied[NEPOCHS];
+
+	/*
+	 * Set up by mm_heap_stats_export().  The shared page the statistics
+	 * are published to and its name, the free blocks and bytes on each
+	 * bin's lists, counted only while it is set, and the requests since
+	 * then.  mem_sbrk calls are always counted.
+	 */
+	struct mmstat_page *stats;
+	char *stats_name;
+	size_t stats_blocks[NBINS];
+	size_t stats_bytes[NBINS];
+	uint64_t nallocs, nfrees, nsbrk;
+
+	/*
+	 * The live bytes and blocks of each tag, see mm_malloc_tagged().
+	 * Only written under "lock", so they need no atomic updates, but
+	 * they may be read at any time.
+	 */
+	_Atomic size_t tag_bytes[MM_NTAGS];
+	_Atomic size_t tag_blocks[MM_NTAGS];
+
+	/*
+	 * "lock" guards everything above while "lockers", the consolidator
+	 * thread and the front-end caches, is not zero.
+	 */
+	int lockers;
+	pthread_mutex_t lock;
+
+	/*
+	 * Only used while a consolidator thread runs, see
+	 * mm_heap_consolidator_start().  Freed blocks wait on "pending",
+	 * still marked allocated, until the thread coalesces them.
+	 */
+	bool deferred;
+	_Atomic(struct node *) pending;
+	atomic_bool stop;
+	pthread_t thread;
+};
+
+/*
+ * A front-end cache: a stack of free blocks of each class's size, which
+ * the central heap still counts as allocated.  Per-thread caches are
+ * linked on "all_caches"; per-CPU caches are taken with "busy".
+ */
+struct mm_cache {
+	_Alignas(64) atomic_flag busy;
+	struct mm_cache *next;
+	int count[NCLASSES];
+	void *slots[NCLASSES][CACHESLOTS];
+};
+
+/*
+ * A transfer cache: full batches of free blocks of one class, passed
+ * between front-end caches without going through the heap's free lists.
+ */
+struct mm_xfer {
+	_Alignas(64) pthread_mutex_t lock;
+	int nbatches;
+	void *batches[XFERBATCHES][CACHEBATCH];
 };
 
+/*
+ * The header at the start of a tiny page.  Set bits in "map" mark free
+ * slots; the slots that the header itself takes up are never free.
+ */
+struct tiny_page {
+	struct tiny_page *next;  /* Next page with free slots of this size */
+	struct tiny_page *prev;  /* Previous page with free slots */
+	unsigned int size;       /* Bytes per slot */
+	unsigned int nfree;      /* Free slots */
+	unsigned int capacity;   /* Free slots when the page is empty */
+	unsigned int owner;      /* Tag of every slot, see mm_malloc_tagged() */
+	uint64_t map[];          /* One bit per slot */
+};
+
+/* Given heap and block ptr bp, compute the index of bp's page. */
+#define PAGE_OF(heap, bp) ((size_t)((char *)(bp) - \
+	(char *)mem_region_lo((heap)->region)) / (heap)->pagesize)
+
+/* Is the block ptr bp in a tiny page, and if so, which? */
+#define IS_TINY(heap, bp)  ((heap)->tiny_map[PAGE_OF(heap, bp)])
+#define TINY_PAGE(heap, bp)  ((struct tiny_page *)((uintptr_t)(bp) & \
+	~((uintptr_t)(heap)->pagesize - 1)))
+
+/*
+ * The smallest region mm_heap_create() can set up a heap in: the heap's
+ * own state, the prologue and epilogue, and a first chunk to allocate
+ * from.
+ */
+#define HEAPMIN	(ASIZE * ((sizeof(struct mm_heap) + (ASIZE - 1)) / ASIZE) + \
+	3 * WSIZE + CHUNKSIZE)
+
+/*
+ * The page sub-heap.  Runs of pages carry boundary tags, but in "tags"
+ * rather than in the pages themselves, so every run is page-aligned.  The
+ * first page of a free run holds its "struct node".
+ */
+struct page_heap {
+	mem_region_t *region;   /* Region holding the tags, then the runs */
+	uintptr_t *tags;        /* One tag word per page */
+	char *base;             /* First page available for runs */
+	size_t pagesize;        /* Bytes per page */
+	size_t npages;          /* Pages currently in the sub-heap */
+	size_t max_pages;       /* Pages the region can hold */
+	struct node *free_runs; /* Head of the free runs list */
+};
+
+/* Given run ptr bp, compute address of its header and footer tags. */
+#define PAGE_INDEX(ph, bp)  ((size_t)((char *)(bp) - (ph)->base) / \
+	(ph)->pagesize)
+#define PAGE_HDRP(ph, bp)   (&(ph)->tags[PAGE_INDEX(ph, bp)])
+#define PAGE_FTRP(ph, bp)   (PAGE_HDRP(ph, bp) + \
+	GET_SIZE(PAGE_HDRP(ph, bp)) / (ph)->pagesize - 1)
+
 /* Global variables: */
-static char *heap_listp; /* Pointer to first block */
-//static int binNum = 12;
-//char *list_start;
-static struct node *list_start;
+static struct mm_heap default_heap;
+static struct page_heap page_heap;
+static pthread_mutex_t page_heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Largest block size held by each bin; the last bin is unbounded. */
+static const size_t bin_limits[NBINS - 1] = { MM_BIN_LIMITS };
+
+/* Predicted lifetime class of unhinted requests in each bin. */
+static int lifetime_table[NBINS];
+
+/* The front-end caches, see mm_cache_enable(). */
+static int cache_mode;                  /* MM_CACHE_NONE, _THREAD or _CPU */
+static const size_t class_sizes[NCLASSES] = {
+	40, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024
+};
+static signed char class_table[1024 / ASIZE + 1]; /* Block size to class */
+static struct mm_cache *cpu_caches;     /* MM_CACHE_CPU: one per CPU */
+static int ncpu_caches;
+static struct mm_cache *all_caches;     /* MM_CACHE_THREAD: every cache */
+static pthread_mutex_t all_caches_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;         /* Flushes a cache at thread exit */
+static __thread struct mm_cache *thread_cache;
+static struct mm_xfer xfer_caches[NCLASSES];
+
+#ifdef MM_INDEX
+/* The fastest index scan that this CPU supports, and its selection. */
+static size_t (*index_scan)(const uint32_t *sizes, size_t n, uint32_t asize);
+static pthread_once_t index_once = PTHREAD_ONCE_INIT;
+#endif
+
+#ifdef MM_HARDENED
+/* The secret mixed into checksums and links, and its initialization. */
+static uintptr_t mm_secret;
+static pthread_once_t mm_secret_once = PTHREAD_ONCE_INIT;
+#endif
 
 /* Function prototypes for internal helper routines: */
-static void *coalesce(void *bp);
-static void *extend_heap(size_t words);
-static void *find_fit(size_t asize);
-static void place(void *bp, size_t asize);
+static void *coalesce(struct mm_heap *heap, void *bp);
+static void *extend_heap(struct mm_heap *heap, size_t words, int life);
+static void *find_fit(struct mm_heap *heap, size_t asize, int bin, int end,
+    int life);
+static void *fit(struct mm_heap *heap, size_t asize, int bin, int life);
+static void place(struct mm_heap *heap, void *bp, size_t asize, int life);
 
 /* Function prototypes for heap consistency checker routines: */
 static void checkblock(void *bp);
-static void checkheap(bool verbose);
-static void printblock(void *bp); 
+static void checkheap(struct mm_heap *heap, bool verbose);
+static void printblock(struct mm_heap *heap, void *bp);
 
 
 /* Function prototypes we added */
-//static void placeListFront(int bin, void *bp);
-static void add_to_front(void *bp);
-static void splice(struct node *nodep);
-//static int findBin(size_t asize);
+static int heap_init(struct mm_heap *heap, mem_region_t *region);
+static void *malloc_class(struct mm_heap *heap, size_t asize, int bin,
+    int life);
+static size_t adjust_size(size_t size);
+static void add_to_front(struct mm_heap *heap, void *bp);
+static void splice(struct mm_heap *heap, struct node *nodep);
+static int find_bin(size_t asize);
+static int near_map_init(struct mm_heap *heap);
+static int heap_share(struct mm_heap *heap);
+static void heap_unshare(struct mm_heap *heap);
+static void heap_lock(struct mm_heap *heap);
+static void heap_unlock(struct mm_heap *heap);
+static void free_block(struct mm_heap *heap, void *bp);
+static struct node *free_pending(struct mm_heap *heap, struct node *list,
+    int max);
+static void *consolidate(void *arg);
+static void decay_reset(struct mm_heap *heap);
+static void decay_tick(struct mm_heap *heap);
+static void decay_reuse(struct mm_heap *heap, size_t npages);
+static void purge(struct mm_heap *heap, size_t npages);
+static size_t purge_block(struct mm_heap *heap, void *bp, size_t npages);
+static size_t mark_pages(struct mm_heap *heap, char *lo, char *hi, int from,
+    int to);
+static void free_pages_of(struct mm_heap *heap, void *bp, char **lo,
+    char **hi);
+static double monotonic_secs(void);
+static void stats_tick(struct mm_heap *heap);
+static void stats_publish(struct mm_heap *heap);
+static void stats_unmap(struct mm_heap *heap);
+static void check_free(void *bp);
+static void set_cached(void *bp, bool cached);
+#ifdef MM_INDEX
+static void index_add(struct mm_heap *heap, struct fit_index *fi, void *bp);
+static void index_remove(struct mm_heap *heap, struct fit_index *fi,
+    void *bp);
+static size_t index_scan_scalar(const uint32_t *sizes, size_t n,
+    uint32_t asize);
+#if defined(__x86_64__) || defined(__i386__)
+static size_t index_scan_avx2(const uint32_t *sizes, size_t n,
+    uint32_t asize);
+#endif
+static void index_free(struct mm_heap *heap);
+static void index_setup(void);
+#endif
+static void *cache_malloc(size_t size);
+static void cache_free(void *bp);
+static struct mm_cache *cache_get(void);
+static void cache_put(struct mm_cache *c);
+static struct mm_cache *cache_create(void);
+static void cache_exit(void *arg);
+static void cache_setup(void);
+static int cache_refill(struct mm_cache *c, int cls);
+static void cache_flush(struct mm_cache *c, int cls, int n);
+static void cache_drop(bool flush);
+static int current_cpu(void);
+#ifdef MM_HARDENED
+static void secret_init(void);
+static void corrupt(const char *what, void *bp);
+#endif
+static void *find_near(struct mm_heap *heap, size_t asize, char *hint);
+static void *find_near_listed(struct mm_heap *heap, size_t asize,
+    size_t first, size_t last);
+static void *malloc_tagged(struct mm_heap *heap, size_t size, int tag);
+static void tag_count(struct mm_heap *heap, int tag, ptrdiff_t bytes,
+    ptrdiff_t blocks);
+static void *tiny_malloc(struct mm_heap *heap, size_t size, int tag);
+static void tiny_free(struct mm_heap *heap, void *bp);
+static struct tiny_page *tiny_page_create(struct mm_heap *heap, int t,
+    int tag);
+static int page_heap_init(struct page_heap *ph);
+static void *page_find_fit(struct page_heap *ph, size_t psize);
+static void *page_extend(struct page_heap *ph, size_t psize);
+static void page_place(struct page_heap *ph, void *bp, size_t psize);
+static void *page_coalesce(struct page_heap *ph, void *bp);
+static void page_add(struct page_heap *ph, void *bp);
+static void page_splice(struct page_heap *ph, void *bp);
 
 
-/* 
+/*
  * Requires:
  *   None.
  *
@@ -117,64 +518,16 @@ static void splice(struct node *nodep);
  *   successfully initialized and -1 otherwise.
  */
 int
-mm_init(void) 
+mm_init(void)
 {
-	/* Create the initial empty heap. */
-	
-	//struct node *head;
-	printf("INIT\n");
-
-	if ((heap_listp = mem_sbrk(3 * WSIZE)) == (void *)-1)
-		return (-1);
-
-	//PUT(heap_listp, 0);                            /* Alignment padding */
-	PUT(heap_listp, PACK(DSIZE, 1)); /* Prologue header */ 
-	PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
-
-	printf("Prologue set\n");
-
-	//temp = heap_listp + (2 * WSIZE);
-	//head = (struct node *)temp;
-	//printf("Initialized head to be two words after the prologue start\n");
-
-	/* Insert the next and previous pointers, the head of the list */
-	/* Can use heap_listp + 2*WSIZE to access head of list */
-	/*PUT(heap_listp + (2 * WSIZE), head.next);
-	PUT(heap_listp + (3 * WSIZE), head.previous);*/
-
-	/*head->previous = head;
-	head->next = head;	
-	list_start = head;*/	
-	
-	PUT(heap_listp + (2 * WSIZE), PACK(0, 1));     /* Epilogue header */
-	heap_listp += (WSIZE);
-	printf("Epilogue set\n");
-
-	/* initialize each bin pointer to -1 */
-	/*for (int i = 0; i < binNum; i++) {
-		PUT(heap_listp + ((i + 2) * WSIZE), (uint64_t)(heap_listp + WSIZE));
-	}
-	list_start = heap_listp + ((binNum + 2) * WSIZE); */
-
-	checkheap(1);
-	
-	printf("Entering extend heap\n");
-	/* Extend the empty heap with a free block of CHUNKSIZE bytes. */
-	if (extend_heap(CHUNKSIZE / WSIZE) == NULL) {
-		printf("Failed INIT\n");
-		return (-1);
-	}
-	
-	printf("Completed init!\n");
-	if (list_start == NULL)
-		printf("List start is NULL!\n");	
-	
-	checkheap(1);
 
-	return (0);
+	/* Whatever the caches held belonged to the old heap. */
+	if (cache_mode != MM_CACHE_NONE)
+		cache_drop(false);
+	return (heap_init(&default_heap, mem_default_region()));
 }
 
-/* 
+/*
  * Requires:
  *   None.
  *
@@ -184,468 +537,3075 @@ mm_init(void)
  *   and NULL otherwise.
  */
 void *
-mm_malloc(size_t size) 
+mm_malloc(size_t size)
 {
-	size_t asize;      /* Adjusted block size */
-	size_t extendsize; /* Amount to extend heap if no fit */
-	void *bp;
-
-	printf("Start malloc\n");
-	/* Ignore spurious requests. */
-	if (size == 0)
-		return (NULL);
-
-	/* Adjust block size to include overhead and alignment reqs. */
-	/* Increased size to 4 words of overhead from 2 */
-	/* Smallest useable block size is now 2 words instead of 1 */
-	if (size <= ASIZE)
-		asize = ASIZE + QSIZE;
-	else
-		asize = ASIZE * ((size + QSIZE + (ASIZE - 1)) / ASIZE);
-
-	/* Search the free list for a fit. */
-	if ((bp = find_fit(asize)) != NULL) {
-		place(bp, asize);
-		return (bp);
-	}
-
-	/* No fit found.  Get more memory and place the block. */
-	extendsize = MAX(asize, CHUNKSIZE);
-	if ((bp = extend_heap(extendsize / WSIZE)) == NULL)  
-		return (NULL);
-
-	place(bp, asize);
-	checkheap(1);
 
-	return (bp);
-} 
+	if (cache_mode != MM_CACHE_NONE && size > TINYMAX)
+		return (cache_malloc(size));
+	return (mm_heap_malloc(&default_heap, size));
+}
 
-/* 
+/*
  * Requires:
- *   "bp" is either the address of an allocated block or NULL.
+ *   0 <= "tag" < MM_NTAGS.
  *
  * Effects:
- *   Free a block.
+ *   mm_malloc() of a block owned by "tag".  The tag is kept in spare bits
+ *   of the block's boundary tags or in the header of its tiny page, and
+ *   the block is counted in the tag's statistics until it is freed.  Tag
+ *   0 is mm_malloc().
  */
-void
-mm_free(void *bp)
+void *
+mm_malloc_tagged(size_t size, int tag)
 {
-	size_t size;
-
-	
-	/* Ignore spurious requests. */
-	if (bp == NULL)
-		return;
-
-	/* Free and coalesce the block. */
-	size = GET_SIZE(HDRP(bp));
 
-	/* Reset Header and Footer to be free */
-	PUT(HDRP(bp), PACK(size, 0));
-	PUT(FTRP(bp), PACK(size, 0));
-	coalesce(bp);
-
-	checkheap(1);
+	if (tag == 0 || PACK_OWNER(tag) == 0)
+		return (mm_malloc(size));
+	return (malloc_tagged(&default_heap, size, tag));
 }
 
 /*
  * Requires:
- *   "ptr" is either the address of an allocated block or NULL.
+ *   0 < "tag" < MM_NTAGS.
  *
  * Effects:
- *   Reallocates the block "ptr" to a block with at least "size" bytes of
- *   payload, unless "size" is zero.  If "size" is zero, frees the block
- *   "ptr" and returns NULL.  If the block "ptr" is already a block with at
- *   least "size" bytes of payload, then "ptr" may optionally be returned.
- *   Otherwise, a new block is allocated and the contents of the old block
- *   "ptr" are copied to that new block.  Returns the address of this new
- *   block if the allocation was successful and NULL otherwise.
+ *   Returns the bytes, counting whole blocks, and the number of blocks
+ *   allocated with "tag" and not yet freed.  The two counts are read
+ *   separately and may be momentarily out of step with each other.
  */
-void *
-mm_realloc(void *ptr, size_t size)
+mm_tag_stats_t
+mm_tag_stats(int tag)
 {
-	size_t oldsize;
-	void *newptr;
-
-	/* If size == 0 then this is just free, and we return NULL. */
-	if (size == 0) {
-		mm_free(ptr);
-		return (NULL);
-	}
-
-	/* If oldptr is NULL, then this is just malloc. */
-	if (ptr == NULL)
-		return (mm_malloc(size));
-
-	newptr = mm_malloc(size);
+	mm_tag_stats_t stats;
 
-	/* If realloc() fails the original block is left untouched  */
-	if (newptr == NULL)
-		return (NULL);
-
-	/* Copy the old data. */
-	oldsize = GET_SIZE(HDRP(ptr));
-	if (size < oldsize)
-		oldsize = size;
-	memcpy(newptr, ptr, oldsize);
-
-	/* Free the old block. */
-	mm_free(ptr);
-	checkheap(1);
-	return (newptr);
+	stats.bytes = atomic_load_explicit(&default_heap.tag_bytes[tag],
+	    memory_order_relaxed);
+	stats.blocks = atomic_load_explicit(&default_heap.tag_blocks[tag],
+	    memory_order_relaxed);
+	return (stats);
 }
 
-/*
- * The following routines are internal helper routines.
- */
-
 /*
  * Requires:
- *   "bp" is the address of a newly freed block.
+ *   "asize" is a block size computed as in mm_malloc() and "bin" is the
+ *   size class of "asize" under MM_BIN_LIMITS.
  *
  * Effects:
- *   Perform boundary tag coalescing.  Returns the address of the coalesced
- *   block.
+ *   Allocate a block of "asize" bytes from the default heap, searching the
+ *   free lists from "bin" upward.  Returns the address of this block if the
+ *   allocation was successful and NULL otherwise.
  */
-static void *
-coalesce(void *bp) 
+void *
+mm_malloc_class(size_t asize, int bin)
 {
-	printf("Start coalesce\n");
-	if (bp == NULL)
-		printf("Pointer is NULL\n");
-	struct node *new_node;	
-	size_t size = GET_SIZE(HDRP(bp));
-	
-	printf("Got size\n");
-	bool prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
-	printf("Stored whether previous block was allocated\n");
-	bool next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-	printf("Stored whether the next block was allocated\n");
-	printf("Finished coalesce initializations\n");
-	if (prev_alloc && next_alloc) {                 /* Case 1 */
-		printf("Case 1\n");
-		return (bp);
-	} else if (prev_alloc && !next_alloc) {         /* Case 2 */
-		printf("Case 2\n");
-		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-		PUT(HDRP(bp), PACK(size, 0));
-		PUT(FTRP(bp), PACK(size, 0));
-		splice((struct node *)NEXT_BLKP(bp));
-	} else if (!prev_alloc && next_alloc) {         /* Case 3 */
-		printf("Case 3\n");
-		size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-		PUT(FTRP(bp), PACK(size, 0));
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-
-		/* Seems to work for now, but rather hackish */
-		/* the issue arises because bp is not actually in the list yet (I think) */
-		struct node *temp = (struct node *)bp;
-		if (temp->next != NULL)
-			splice(bp);
-		bp = PREV_BLKP((void *)bp);
-	} else {                                        /* Case 4 */
-		printf("Case 4\n");
-		size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
-		    GET_SIZE(FTRP(NEXT_BLKP(bp)));
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-		PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
-		splice((struct node *)bp);
-		splice((struct node *)NEXT_BLKP(bp));
-		bp = PREV_BLKP(bp);
-	}
-	
-	new_node = (struct node *)coalesce(bp);
-	new_node->next = list_start;
-	new_node->previous = NULL;
-	list_start->previous = new_node;
-	list_start = new_node;
-	checkheap(1);
+	void *bp;
+
+	heap_lock(&default_heap);
+	bp = malloc_class(&default_heap, asize, bin, lifetime_table[bin]);
+	heap_unlock(&default_heap);
 	return (bp);
 }
 
-/* 
+/*
  * Requires:
- *   words: the number of words to increase the heap by
- *   next: next pointer at the end of the linked list, to be set to the 
- 	   header of the new block
+ *   "hint" is MM_HINT_NONE, MM_HINT_SHORT or MM_HINT_LONG.
+ *
  * Effects:
- *   Extend the heap with a free block and return that block's address.
+ *   mm_malloc() with a prediction of the block's lifetime.  Short- and
+ *   long-lived blocks are carved from different chunks of the heap, so
+ *   that short-lived blocks do not leave holes between long-lived ones.
+ *   MM_HINT_NONE uses the table set by mm_set_lifetime_table().
  */
-static void *
-extend_heap(size_t words) 
+void *
+mm_malloc_hint(size_t size, int hint)
 {
-	size_t size;
+	size_t asize;      /* Adjusted block size */
+	int bin, life;
 	void *bp;
 
-	/* Allocate an even number of words to maintain alignment. */
-	size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-
-	if ((bp = mem_sbrk(size)) == (void *)-1)  
+	/* Ignore spurious requests. */
+	if (size == 0)
 		return (NULL);
-	printf("Before extended block is added to the free list\n");
-	checkheap(1);
-	/* Initialize the new node pointers, next precedes previous */
-	/* The previous point points to the header of the previous block*/	
-	
-	/*PUT(bp, NULL);
-	PUT(bp + WSIZE, HDRP(next));*/
-
-	/* Initialize free block header/footer and the epilogue header. */
-	PUT(HDRP(bp), PACK(size, 0));         /* Free block header */
-	PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */
-	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
-	
-	/* If list start is NULL, initialize the start to the pointer to the
-	 * added block
-	 */
-	if (list_start == NULL) {
-		list_start = (struct node *)bp;
-		list_start->next = list_start;
-		list_start->previous = list_start;
-	}
 
-	printf("For isolation\n");
-
-	add_to_front(bp);
-	printf("After extended block is added to the free list\n");
-	checkheap(1);
-	printf("Entering coalesce from extend_heap\n");
-	/* Coalesce if the previous block was free. */
-	return (coalesce(bp));
+	asize = adjust_size(size);
+	bin = find_bin(asize);
+	if (hint == MM_HINT_SHORT)
+		life = LIFE_SHORT;
+	else if (hint == MM_HINT_LONG)
+		life = LIFE_LONG;
+	else
+		life = lifetime_table[bin];
+	heap_lock(&default_heap);
+	bp = malloc_class(&default_heap, asize, bin, life);
+	heap_unlock(&default_heap);
+	return (bp);
 }
 
 /*
  * Requires:
- *   None.
+ *   "hint" is NULL or the address of an allocated block.
  *
  * Effects:
- *   Find a fit for a block with "asize" bytes.  Returns that block's address
- *   or NULL if no suitable block was found. 
+ *   mm_malloc_near() for the default heap.
  */
-static void *
-find_fit(size_t asize)
-{
-	//void *bp;
-	struct node *cur = list_start;
-	
-	
-	/* Iterate through the list, find first fit */
-	do {
-		if (asize <= GET_SIZE(HDRP(cur)))
-			return cur;
-		cur = cur->next;
-	} while (cur != list_start);
-	
-	/* Search for the first fit. 
-	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-		if (!GET_ALLOC(HDRP(bp)) && asize <= GET_SIZE(HDRP(bp)))
-			return (bp);
-	} */
+void *
+mm_malloc_near(size_t size, void *hint)
+{
 
-	/* No fit was found. */
-	return (NULL);
+	return (mm_heap_malloc_near(&default_heap, size, hint));
 }
 
-/* 
+/*
  * Requires:
- *   "bp" is the address of a free block that is at least "asize" bytes.
+ *   "hint" is NULL or the address of a block allocated from "heap".
  *
  * Effects:
- *   Place a block of "asize" bytes at the start of the free block "bp" and
- *   split that block if the remainder would be at least the minimum block
- *   size. 
+ *   mm_malloc() that places the block close to "hint": in a free block on
+ *   the same page if there is one, otherwise in the nearest free block
+ *   within NEARPAGES pages after it.  Falls back to an ordinary allocation
+ *   when there is no such block.
  */
-static void
-place(void *bp, size_t asize)
-{
-	size_t csize = GET_SIZE(HDRP(bp));
-	struct node *nodep = (struct node *) bp;
-	struct node *new_nodep;
-
-	/* increased size to account for next and previous pointer overhead */
-	if ((csize - asize) >= (ASIZE + QSIZE)) { 
-		PUT(HDRP(bp), PACK(asize, 1));
-		PUT(FTRP(bp), PACK(asize, 1));
-		
-		bp = NEXT_BLKP(bp);
-		PUT(HDRP(bp), PACK(csize - asize, 0));
-		PUT(FTRP(bp), PACK(csize - asize, 0));
-		
-		/* Set new node for the leftover free block */
-		new_nodep = (struct node *)bp;
-		
-		new_nodep->previous = nodep->previous;
-		new_nodep->next = nodep->next;
-				
-		/* Remove node from allocated block */
-		splice(nodep);
-		
-	} else {
-		PUT(HDRP(bp), PACK(csize, 1));
-		PUT(FTRP(bp), PACK(csize, 1));
-		
-		/* Remove node from allocated block */
-		splice(nodep);
-	}
-	checkheap(1);
-}
-
-static void
-add_to_front(void *bp)
-{
-	struct node *nodep = (struct node *)bp;
-	nodep->next = list_start;
-	nodep->previous = list_start->previous;
-	list_start->previous->next = nodep;
-	list_start->previous = nodep;
-	list_start = nodep;
-
-}
-
-static void
-splice(struct node *nodep)
+void *
+mm_heap_malloc_near(mm_heap_t *heap, size_t size, void *hint)
 {
-	printf("Start splice\n");
-	if (nodep == NULL)
-		printf("Node pointer is NULL!\n");
-	if (nodep->previous == NULL)
-		printf("Node pointer's previous is NULL!\n");
-	if (nodep->next == NULL)
-		printf("Node pointer's next is NULL!\n");
+	size_t asize;      /* Adjusted block size */
+	int bin;
+	void *bp;
 
-	nodep->previous->next = nodep->next;
-	nodep->next->previous = nodep->previous;
-	nodep->next = NULL;
-	nodep->previous = NULL;
-	printf("End splice\n");
+	/* Ignore spurious requests. */
+	if (size == 0)
+		return (NULL);
 
+	asize = adjust_size(size);
+	bin = find_bin(asize);
+
+	/* A tiny block has no tags; start from the block holding its page. */
+	if (hint != NULL && IS_TINY(heap, hint))
+		hint = TINY_PAGE(heap, hint);
+	heap_lock(heap);
+	if (hint != NULL && (heap->near_map != NULL ||
+	    near_map_init(heap) == 0) &&
+	    (bp = find_near(heap, asize, hint)) != NULL)
+		place(heap, bp, asize, lifetime_table[bin]);
+	else
+		bp = malloc_class(heap, asize, bin, lifetime_table[bin]);
+	heap_unlock(heap);
+	return (bp);
 }
 
 /*
  * Requires:
- *   asize
+ *   "table" is NULL or has MM_NBINS entries, each MM_HINT_SHORT or
+ *   MM_HINT_LONG.
  *
  * Effects:
- *   Returns bin where size is less than or equal to bin max
+ *   Set the lifetime predicted for unhinted requests in each size class,
+ *   e.g., from a profile of an earlier run.  NULL predicts that every
+ *   block is long-lived, which is the initial setting.
  */
-// int
-// findBin(size_t asize)
-// {	
-// 	if (asize <= 32)
-// 		return 0;
-// 	else if (asize <= 64)
-// 		return 1;
-// 	else if (asize <= 128)
-// 		return 2;
-// 	else if (asize <= 256)
-// 		return 3;
-// 	else if (asize <= 512)
-// 		return 4;
-// 	else if (asize <= 1024)
-// 		return 5;
-// 	else if (asize <= 2048)
-// 		return 6;
-// 	else if (asize <= 4096)
-// 		return 7;
-// 	else if (asize <= 8192)
-// 		return 8;
-// 	else if (asize <= 16384)
-// 		return 9;
-// 	else if (asize <= 32768)
-// 		return 10;
-// 	else
-// 		return 11;
-// }
-
-/*
- * Requires:
- *   Valid bin
- *   Valid pointer bp
- *
- * Effects:
- *   Put pointer's memory block in front of linked list for bin
- */
- 
-// static void
-// placeListFront(int bin, void *bp)
-// {
-// 	void *old_bp;
-// 
-// 	/* Find free block of bin*/
-// 	old_bp = (void *) GET((BIN_DIST(bin) + heap_listp));
-// 
-// 	/* Start at head of list */
-// 	if (old_bp != heap_listp) {
-// 		/* Set old head previous to be bp of new block */
-// 		SET_PREV(old_bp, bp);
-// 		/* Set new block next to be old bp */
-// 		SET_NEXT(bp, old_bp);
-// 	}
-// 	else{
-// 		SET_NEXT(bp, heap_listp);
-// 	}
-// 
-// 	/* Set previous of new block to NULL */
-// 	SET_PREV(bp, heap_listp);
-// 	/* Set bin to point to new head */
-// 	SET_NEXT(BIN_DIST(bin) + heap_listp, bp);
-// }
-
+void
+mm_set_lifetime_table(const int *table)
+{
+	int bin;
 
-/* 
- * The remaining routines are heap consistency checker routines. 
- */
+	for (bin = 0; bin < NBINS; bin++) {
+		lifetime_table[bin] = (table != NULL &&
+		    table[bin] == MM_HINT_SHORT) ? LIFE_SHORT : LIFE_LONG;
+	}
+}
 
 /*
  * Requires:
- *   "bp" is the address of a block.
+ *   "size" is not zero.
  *
  * Effects:
- *   Perform a minimal check on the block "bp".
+ *   Returns the size class that a request for "size" bytes is served from.
  */
-static void
-checkblock(void *bp) 
+int
+mm_size_class(size_t size)
 {
 
-	if ((uintptr_t)bp % ASIZE)
-		printf("Error: %p is not word aligned\n", bp);
-	if (GET(HDRP(bp)) != GET(FTRP(bp)))
-		printf("Error: header does not match footer\n");
+	return (find_bin(adjust_size(size)));
 }
 
-/* 
+/*
  * Requires:
- *   None.
+ *   "bp" is either the address of an allocated block or NULL.
  *
  * Effects:
- *   Perform a minimal check of the heap for consistency. 
+ *   Free a block.
  */
 void
-checkheap(bool verbose) 
+mm_free(void *bp)
 {
-	void *bp;
 
-	if (verbose)
-		printf("Heap (%p):\n", heap_listp);
+	if (cache_mode != MM_CACHE_NONE && bp != NULL &&
+	    !IS_TINY(&default_heap, bp))
+		cache_free(bp);
+	else
+		mm_heap_free(&default_heap, bp);
+}
 
-	if (GET_SIZE(HDRP(heap_listp)) != DSIZE)
-		printf("Bad prologue header: size\n");
-	if (!GET_ALLOC(HDRP(heap_listp)))
+/*
+ * Requires:
+ *   "ptr" is either the address of an allocated block or NULL.
+ *
+ * Effects:
+ *   Reallocates the block "ptr" to a block with at least "size" bytes of
+ *   payload, unless "size" is zero.  If "size" is zero, frees the block
+ *   "ptr" and returns NULL.  If the block "ptr" is already a block with at
+ *   least "size" bytes of payload, then "ptr" may optionally be returned.
+ *   Otherwise, a new block is allocated and the contents of the old block
+ *   "ptr" are copied to that new block.  Returns the address of this new
+ *   block if the allocation was successful and NULL otherwise.
+ */
+void *
+mm_realloc(void *ptr, size_t size)
+{
+
+	return (mm_heap_realloc(&default_heap, ptr, size));
+}
+
+/*
+ * The following routines operate on an explicit heap.
+ */
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Create a new heap that can grow to "max_size" bytes, independent of
+ *   the default heap and of every other heap.  Returns the new heap or
+ *   NULL if it could not be created, which it cannot be in fewer than
+ *   HEAPMIN bytes, enough for the heap's own state and a first chunk.
+ */
+mm_heap_t *
+mm_heap_create(size_t max_size)
+{
+	mem_region_t *region;
+	struct mm_heap *heap;
+
+	if (max_size < HEAPMIN ||
+	    (region = mem_region_create(max_size)) == NULL)
+		return (NULL);
+
+	/* The heap's own state is the first thing in its region. */
+	heap = mem_region_sbrk(region, ASIZE * ((sizeof(struct mm_heap) +
+	    (ASIZE - 1)) / ASIZE));
+	if (heap == (void *)-1) {
+		mem_region_destroy(region);
+		return (NULL);
+	}
+	heap->near_map = NULL;
+	heap->dirty_map = NULL;
+	heap->tiny_map = NULL;
+	heap->stats = NULL;
+#ifdef MM_INDEX
+	memset(heap->index, 0, sizeof(heap->index));
+#endif
+	heap->lockers = 0;
+	heap->deferred = false;
+	if (heap_init(heap, region) < 0) {
+		mem_region_destroy(region);
+		return (NULL);
+	}
+	return (heap);
+}
+
+/*
+ * Requires:
+ *   "heap" was returned by mm_heap_create() and has no consolidator
+ *   thread.
+ *
+ * Effects:
+ *   Release "heap" and every block allocated from it in one step.
+ */
+void
+mm_heap_destroy(mm_heap_t *heap)
+{
+
+	stats_unmap(heap);
+	free(heap->near_map);
+	free(heap->dirty_map);
+	free(heap->tiny_map);
+#ifdef MM_INDEX
+	index_free(heap);
+#endif
+	mem_region_destroy(heap->region);
+}
+
+/*
+ * Requires:
+ *   "heap" is an initialized heap.
+ *
+ * Effects:
+ *   mm_malloc() for an explicit heap.
+ */
+void *
+mm_heap_malloc(mm_heap_t *heap, size_t size)
+{
+	size_t asize;      /* Adjusted block size */
+	int bin;
+	void *bp;
+
+	/* Ignore spurious requests. */
+	if (size == 0)
+		return (NULL);
+
+	heap_lock(heap);
+	if (size <= TINYMAX)
+		bp = tiny_malloc(heap, size, 0);
+	else {
+		asize = adjust_size(size);
+		bin = find_bin(asize);
+		bp = malloc_class(heap, asize, bin, lifetime_table[bin]);
+	}
+	heap_unlock(heap);
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   "bp" is either the address of a block allocated from "heap" or NULL.
+ *
+ * Effects:
+ *   mm_free() for an explicit heap.
+ */
+void
+mm_heap_free(mm_heap_t *heap, void *bp)
+{
+	struct node *nodep = bp;
+	struct node *head;
+
+	/* Ignore spurious requests. */
+	if (bp == NULL)
+		return;
+	if (IS_TINY(heap, bp)) {
+		heap_lock(heap);
+		tiny_free(heap, bp);
+		heap_unlock(heap);
+		return;
+	}
+	check_free(bp);
+
+	/* Leave the block to the consolidator, if there is one. */
+	if (heap->deferred) {
+		head = atomic_load(&heap->pending);
+		do
+			nodep->next = head;
+		while (!atomic_compare_exchange_weak(&heap->pending, &head,
+		    nodep));
+		return;
+	}
+	heap_lock(heap);
+	free_block(heap, bp);
+	heap_unlock(heap);
+}
+
+/*
+ * Requires:
+ *   "ptr" is either the address of a block allocated from "heap" or NULL.
+ *
+ * Effects:
+ *   mm_realloc() for an explicit heap.
+ */
+void *
+mm_heap_realloc(mm_heap_t *heap, void *ptr, size_t size)
+{
+	size_t oldsize;
+	void *newptr;
+	int owner;
+
+	/* If size == 0 then this is just free, and we return NULL. */
+	if (size == 0) {
+		mm_heap_free(heap, ptr);
+		return (NULL);
+	}
+
+	/* If oldptr is NULL, then this is just malloc. */
+	if (ptr == NULL)
+		return (mm_heap_malloc(heap, size));
+
+	/* Grow in place when the neighbouring space allows it. */
+	if (mm_heap_try_expand(heap, ptr, size, size) != 0)
+		return (ptr);
+
+	/* The new block keeps the old block's tag. */
+	owner = IS_TINY(heap, ptr) ? (int)TINY_PAGE(heap, ptr)->owner :
+	    GET_OWNER(HDRP(ptr));
+	if (owner != 0)
+		newptr = malloc_tagged(heap, size, owner);
+	else
+		newptr = mm_heap_malloc(heap, size);
+
+	/* If realloc() fails the original block is left untouched  */
+	if (newptr == NULL)
+		return (NULL);
+
+	/* Copy the old data. */
+	if (IS_TINY(heap, ptr))
+		oldsize = TINY_PAGE(heap, ptr)->size;
+	else
+		oldsize = GET_SIZE(HDRP(ptr)) - DSIZE;
+	if (size < oldsize)
+		oldsize = size;
+	memcpy(newptr, ptr, oldsize);
+
+	/* Free the old block. */
+	mm_heap_free(heap, ptr);
+	return (newptr);
+}
+
+/*
+ * Requires:
+ *   "ptr" is the address of an allocated block.
+ *
+ * Effects:
+ *   mm_try_expand() for the default heap.
+ */
+size_t
+mm_try_expand(void *ptr, size_t min, size_t preferred)
+{
+
+	return (mm_heap_try_expand(&default_heap, ptr, min, preferred));
+}
+
+/*
+ * Requires:
+ *   "ptr" is the address of a block allocated from "heap".
+ *
+ * Effects:
+ *   Grow the block "ptr" in place so that it has at least "min" and, if
+ *   possible, "preferred" bytes of payload, by absorbing the free block
+ *   that follows it and, when the block ends the heap, by extending the
+ *   heap.  Returns the block's new payload size, or 0 if it cannot hold
+ *   "min" bytes without moving, in which case nothing is changed.
+ */
+size_t
+mm_heap_try_expand(mm_heap_t *heap, void *ptr, size_t min, size_t preferred)
+{
+	size_t csize, amin, apref, avail, newsize;
+	int life, rest_life, owner;
+	char *next, *end;
+	bool top;
+
+	/* A tiny block can only grow within its slot. */
+	if (IS_TINY(heap, ptr))
+		return (min <= TINY_PAGE(heap, ptr)->size ?
+		    TINY_PAGE(heap, ptr)->size : 0);
+
+	csize = GET_SIZE(HDRP(ptr));
+	life = rest_life = GET_LIFE(HDRP(ptr));
+	owner = GET_OWNER(HDRP(ptr));
+	next = NEXT_PHYS_BLKP(ptr);
+	if (preferred < min)
+		preferred = min;
+	heap_lock(heap);
+	amin = adjust_size(min);
+	apref = adjust_size(preferred);
+	if (csize >= amin) {
+		heap_unlock(heap);
+		return (csize - DSIZE);
+	}
+
+	/* Count the free neighbour, and whether the heap ends after it. */
+	avail = csize;
+	end = next;
+	if (!GET_ALLOC(HDRP(next))) {
+		avail += GET_SIZE(HDRP(next));
+		end = NEXT_PHYS_BLKP(next);
+	}
+
+	/* Grow into the wilderness if that is what is missing. */
+	if (avail < apref && GET_SIZE(HDRP(end)) == 0 &&
+	    extend_heap(heap, MAX(apref - avail, CHUNKSIZE) / WSIZE,
+	    life) != NULL) {
+		next = NEXT_PHYS_BLKP(ptr);
+		avail = csize + GET_SIZE(HDRP(next));
+	}
+	if (avail < amin) {
+		heap_unlock(heap);
+		return (0);
+	}
+
+	/* Absorb the neighbour, returning any excess beyond "preferred". */
+	top = avail > csize && next == heap->top;
+	if (avail > csize) {
+		rest_life = GET_LIFE(HDRP(next));
+		if (top)
+			heap->top = NULL;
+		else
+			splice(heap, (struct node *)next);
+	}
+	newsize = avail;
+	if (avail >= apref && (avail - apref) >= (ASIZE + QSIZE))
+		newsize = apref;
+	PUT(HDRP(ptr), PACK_LIFE(newsize, 1, life) | PACK_OWNER(owner));
+	PUT(FTRP(ptr), PACK_LIFE(newsize, 1, life) | PACK_OWNER(owner));
+	if (owner != 0)
+		tag_count(heap, owner, newsize - csize, 0);
+	if (heap->dirty_map != NULL)
+		decay_reuse(heap, mark_pages(heap, HDRP(ptr), FTRP(ptr) +
+		    WSIZE, -1, PAGE_USED));
+	if (newsize < avail) {
+		next = NEXT_PHYS_BLKP(ptr);
+		PUT(HDRP(next), PACK_LIFE(avail - newsize, 0, rest_life));
+		PUT(FTRP(next), PACK_LIFE(avail - newsize, 0, rest_life));
+		if (top)
+			heap->top = next;
+		else
+			add_to_front(heap, next);
+	}
+	heap_unlock(heap);
+	return (newsize - DSIZE);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   mm_reserve() for the default heap.
+ */
+int
+mm_reserve(size_t bytes)
+{
+
+	return (mm_heap_reserve(&default_heap, bytes));
+}
+
+/*
+ * Requires:
+ *   "heap" is an initialized heap.
+ *
+ * Effects:
+ *   Extend "heap" by at least "bytes" bytes as one free block and fault
+ *   its pages in, so that later allocations from it take no page faults.
+ *   Returns 0 on success and -1 if the heap cannot grow that far.
+ */
+int
+mm_heap_reserve(mm_heap_t *heap, size_t bytes)
+{
+	size_t words = (bytes + (WSIZE - 1)) / WSIZE;
+	char *old_brk;
+
+	if (bytes == 0)
+		return (0);
+	heap_lock(heap);
+	old_brk = (char *)mem_region_hi(heap->region) + 1;
+	if (extend_heap(heap, words, LIFE_LONG) == NULL) {
+		heap_unlock(heap);
+		return (-1);
+	}
+
+	/* Before other threads can be handed blocks from the new pages. */
+	mem_prefault(old_brk, (char *)mem_region_hi(heap->region) + 1 -
+	    old_brk);
+	heap_unlock(heap);
+	return (0);
+}
+
+/*
+ * The following routines move coalescing off the free path.  While a
+ * heap's consolidator thread runs, mm_heap_free() only pushes the block on
+ * a lock-free list, and the thread frees and coalesces the pending blocks
+ * in batches.  Every other request then takes the heap's lock.
+ */
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   mm_heap_consolidator_start() for the default heap.
+ */
+int
+mm_consolidator_start(void)
+{
+
+	return (mm_heap_consolidator_start(&default_heap));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   mm_heap_consolidator_stop() for the default heap.
+ */
+void
+mm_consolidator_stop(void)
+{
+
+	mm_heap_consolidator_stop(&default_heap);
+}
+
+/*
+ * Requires:
+ *   "heap" is an initialized heap without a consolidator thread, and no
+ *   other thread is using it.
+ *
+ * Effects:
+ *   Start a thread that coalesces the blocks freed from "heap" from now
+ *   on.  Returns 0 on success and -1 if the thread could not be started.
+ */
+int
+mm_heap_consolidator_start(mm_heap_t *heap)
+{
+
+	if (heap_share(heap) < 0)
+		return (-1);
+	atomic_init(&heap->pending, NULL);
+	atomic_init(&heap->stop, false);
+	heap->deferred = true;
+	if (pthread_create(&heap->thread, NULL, consolidate, heap) != 0) {
+		heap->deferred = false;
+		heap_unshare(heap);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Requires:
+ *   "heap" has a consolidator thread, and no other thread is using it.
+ *
+ * Effects:
+ *   Stop the consolidator thread, coalescing every block still pending,
+ *   and return "heap" to freeing blocks eagerly.
+ */
+void
+mm_heap_consolidator_stop(mm_heap_t *heap)
+{
+
+	atomic_store(&heap->stop, true);
+	pthread_join(heap->thread, NULL);
+	heap->deferred = false;
+	free_pending(heap, atomic_exchange(&heap->pending, NULL), -1);
+	heap_unshare(heap);
+}
+
+/*
+ * Requires:
+ *   "heap" has a consolidator thread.
+ *
+ * Effects:
+ *   The consolidator thread.  Takes the whole pending list at once and
+ *   frees it DEFERBATCH blocks per lock hold, so that the thread never
+ *   keeps requests waiting for long.  Sleeps while nothing is pending.
+ */
+static void *
+consolidate(void *arg)
+{
+	struct mm_heap *heap = arg;
+	struct node *batch = NULL;
+	struct timespec nap = { 0, DEFERNAP };
+
+	while (!atomic_load(&heap->stop)) {
+		if (batch == NULL &&
+		    (batch = atomic_exchange(&heap->pending, NULL)) == NULL) {
+			nanosleep(&nap, NULL);
+			continue;
+		}
+		pthread_mutex_lock(&heap->lock);
+		batch = free_pending(heap, batch, DEFERBATCH);
+		pthread_mutex_unlock(&heap->lock);
+	}
+
+	/* Leave nothing behind for mm_heap_consolidator_stop(). */
+	pthread_mutex_lock(&heap->lock);
+	free_pending(heap, batch, -1);
+	pthread_mutex_unlock(&heap->lock);
+	return (NULL);
+}
+
+/*
+ * Requires:
+ *   "list" is a list of pending blocks linked through their "next"
+ *   fields, and the caller holds "heap"'s lock if it has one.
+ *
+ * Effects:
+ *   Free and coalesce up to "max" blocks from "list", or all of them if
+ *   "max" is negative.  Returns the rest of the list.
+ */
+static struct node *
+free_pending(struct mm_heap *heap, struct node *list, int max)
+{
+	struct node *nodep;
+
+	while (list != NULL && max-- != 0) {
+		nodep = list;
+		list = list->next;
+		check_free(nodep);    /* Catches blocks queued twice */
+		free_block(heap, nodep);
+	}
+	return (list);
+}
+
+/*
+ * The following routines return the pages of free blocks to the system
+ * gradually.  A page inside a free block is dirty from the time the block
+ * is freed until it is purged with mem_purge() or reused.  Of the pages
+ * made dirty "age" seconds ago, a fraction 1 - smoothstep(age / decay
+ * time) may still be dirty, so memory drains smoothly after a spike
+ * rather than all at once, and is gone after the decay time.
+ */
+
+/*
+ * Requires:
+ *   "secs" is not negative.
+ *
+ * Effects:
+ *   mm_heap_set_decay() for the default heap.
+ */
+int
+mm_set_decay(double secs, double (*clock)(void))
+{
+
+	return (mm_heap_set_decay(&default_heap, secs, clock));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   mm_heap_decay() for the default heap.
+ */
+void
+mm_decay(void)
+{
+
+	mm_heap_decay(&default_heap);
+}
+
+/*
+ * Requires:
+ *   "heap" is an initialized heap that no other thread is using, and
+ *   "secs" is not negative.
+ *
+ * Effects:
+ *   Purge the pages of "heap"'s free blocks over "secs" seconds as read
+ *   from "clock", or from the monotonic clock if "clock" is NULL.  Zero
+ *   "secs" turns purging off.  The free blocks already in "heap" count as
+ *   freshly dirty.  Returns 0 on success and -1 if there is no memory for
+ *   the dirty map.
+ */
+int
+mm_heap_set_decay(mm_heap_t *heap, double secs, double (*clock)(void))
+{
+	size_t npages;
+	char *bp, *lo, *hi;
+
+	free(heap->dirty_map);
+	heap->dirty_map = NULL;
+	if (secs == 0)
+		return (0);
+
+	npages = mem_region_maxsize(heap->region) / heap->pagesize + 1;
+	if ((heap->dirty_map = calloc(npages, 1)) == NULL)
+		return (-1);
+	heap->decay_secs = secs;
+	heap->clock = (clock != NULL) ? clock : monotonic_secs;
+	decay_reset(heap);
+	for (bp = heap->heap_listp; GET_SIZE(HDRP(bp)) > 0;
+	    bp = NEXT_PHYS_BLKP(bp)) {
+		if (!GET_ALLOC(HDRP(bp))) {
+			free_pages_of(heap, bp, &lo, &hi);
+			heap->ndirty += mark_pages(heap, lo, hi, PAGE_USED,
+			    PAGE_DIRTY);
+		}
+	}
+	heap->dirtied[heap->epoch] = heap->ndirty;
+	return (0);
+}
+
+/*
+ * Requires:
+ *   "heap" is an initialized heap.
+ *
+ * Effects:
+ *   Purge whatever the decay curve allows now.  Frees do this on their
+ *   own; call it while "heap" is idle so that its memory still drains.
+ */
+void
+mm_heap_decay(mm_heap_t *heap)
+{
+
+	heap_lock(heap);
+	if (heap->dirty_map != NULL)
+		decay_tick(heap);
+	heap_unlock(heap);
+}
+
+/*
+ * Requires:
+ *   "heap" has a dirty map.
+ *
+ * Effects:
+ *   Start counting decay epochs afresh, with no dirty pages.
+ */
+static void
+decay_reset(struct mm_heap *heap)
+{
+	int i;
+
+	for (i = 0; i < NEPOCHS; i++)
+		heap->dirtied[i] = 0;
+	heap->epoch = 0;
+	heap->ndirty = 0;
+	heap->epoch_start = heap->clock();
+}
+
+/*
+ * Requires:
+ *   "heap" has a dirty map.
+ *
+ * Effects:
+ *   Once the current epoch is over, move on to the epoch that the clock
+ *   is in and purge the dirty pages beyond what the decay curve allows.
+ */
+static void
+decay_tick(struct mm_heap *heap)
+{
+	double len = heap->decay_secs / NEPOCHS;
+	double now = heap->clock();
+	double x, allowed = 0;
+	long n;
+	int age;
+
+	if (now < heap->epoch_start + len)
+		return;
+	n = (long)((now - heap->epoch_start) / len);
+	heap->epoch_start += n * len;
+	for (n = MIN(n, NEPOCHS); n > 0; n--) {
+		heap->epoch = (heap->epoch + 1) % NEPOCHS;
+		heap->dirtied[heap->epoch] = 0;
+	}
+
+	/* Pages from "age" epochs back may be dirty 1 - smoothstep(x). */
+	for (age = 0; age < NEPOCHS; age++) {
+		x = (double)age / NEPOCHS;
+		allowed += heap->dirtied[(heap->epoch + NEPOCHS - age) %
+		    NEPOCHS] * (1 - x * x * (3 - 2 * x));
+	}
+	if (heap->ndirty > allowed)
+		purge(heap, heap->ndirty - (size_t)allowed);
+}
+
+/*
+ * Requires:
+ *   "heap" has a dirty map and "npages" of its dirty pages were just
+ *   allocated.
+ *
+ * Effects:
+ *   Count the pages as no longer dirty, taking them from the newest
+ *   epochs first, so that the decay curve allows only for the pages
+ *   still dirty.
+ */
+static void
+decay_reuse(struct mm_heap *heap, size_t npages)
+{
+	size_t n;
+	int age, i;
+
+	heap->ndirty -= npages;
+	for (age = 0; age < NEPOCHS && npages > 0; age++) {
+		i = (heap->epoch + NEPOCHS - age) % NEPOCHS;
+		n = MIN(npages, heap->dirtied[i]);
+		heap->dirtied[i] -= n;
+		npages -= n;
+	}
+}
+
+/*
+ * Requires:
+ *   "heap" has a dirty map.
+ *
+ * Effects:
+ *   Purge up to "npages" dirty pages, from the top and then from the
+ *   largest free blocks down, since those are the least likely to be
+ *   reused soon.
+ */
+static void
+purge(struct mm_heap *heap, size_t npages)
+{
+	struct node *cur;
+	int bin, life;
+
+	if (heap->top != NULL)
+		npages = purge_block(heap, heap->top, npages);
+	for (bin = NBINS - 1; bin >= 0 && npages > 0; bin--) {
+		if (bin < NBINS - 1 && bin_limits[bin] < heap->pagesize)
+			break;
+		for (life = 0; life < NLIFE; life++) {
+			for (cur = heap->list_start[life][bin];
+			    cur != NULL && npages > 0; cur = NEXT(cur))
+				npages = purge_block(heap, cur, npages);
+		}
+	}
+}
+
+/*
+ * Requires:
+ *   "heap" has a dirty map and "bp" is the address of a free block.
+ *
+ * Effects:
+ *   Purge up to "npages" of the block's dirty pages, each run of them as
+ *   a whole.  Returns the number of pages still to be purged.
+ */
+static size_t
+purge_block(struct mm_heap *heap, void *bp, size_t npages)
+{
+	char *lo, *hi, *p, *run;
+
+	free_pages_of(heap, bp, &lo, &hi);
+	for (p = lo; p < hi && npages > 0; ) {
+		if (heap->dirty_map[PAGE_OF(heap, p)] != PAGE_DIRTY) {
+			p += heap->pagesize;
+			continue;
+		}
+		for (run = p; p < hi && npages > 0 &&
+		    heap->dirty_map[PAGE_OF(heap, p)] == PAGE_DIRTY;
+		    p += heap->pagesize) {
+			heap->dirty_map[PAGE_OF(heap, p)] = PAGE_CLEAN;
+			heap->ndirty--;
+			npages--;
+		}
+		mem_purge(run, p - run);
+	}
+	return (npages);
+}
+
+/*
+ * Requires:
+ *   "heap" has a dirty map and [lo, hi) lies in its region.
+ *
+ * Effects:
+ *   Set every page that overlaps [lo, hi) and is in state "from", or in
+ *   any state if "from" is negative, to state "to".  Returns the number of
+ *   those pages that were dirty before, or, when "to" is PAGE_DIRTY, the
+ *   number of pages changed.
+ */
+static size_t
+mark_pages(struct mm_heap *heap, char *lo, char *hi, int from, int to)
+{
+	size_t first, last, i, n = 0;
+
+	if (hi <= lo)
+		return (0);
+	first = PAGE_OF(heap, lo);
+	last = PAGE_OF(heap, hi - 1);
+	for (i = first; i <= last; i++) {
+		if (from >= 0 && heap->dirty_map[i] != from)
+			continue;
+		if (to == PAGE_DIRTY || heap->dirty_map[i] == PAGE_DIRTY)
+			n++;
+		heap->dirty_map[i] = to;
+	}
+	return (n);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a free block.
+ *
+ * Effects:
+ *   Compute the whole pages of "bp" that hold nothing but unused payload,
+ *   i.e., that may be purged, as [*lo, *hi).
+ */
+static void
+free_pages_of(struct mm_heap *heap, void *bp, char **lo, char **hi)
+{
+	uintptr_t mask = ~(uintptr_t)(heap->pagesize - 1);
+
+	*lo = (char *)(((uintptr_t)bp + sizeof(struct node) +
+	    heap->pagesize - 1) & mask);
+	*hi = (char *)((uintptr_t)FTRP(bp) & mask);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   The default decay clock: seconds on the monotonic clock.
+ */
+static double
+monotonic_secs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + 1e-9 * ts.tv_nsec);
+}
+
+/*
+ * The following routines export a heap's statistics to a shared memory
+ * page that another process, e.g., mmstat, can watch without stopping
+ * this one.  The page is a seqlock, see mmstat.h.  Keeping it up to date
+ * costs no system calls: the heap counts requests and free blocks as it
+ * goes, and every STATSOPS requests, as well as whenever the heap grows,
+ * copies the counts to the page under its lock.
+ */
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   mm_heap_stats_export() for the default heap.
+ */
+int
+mm_stats_export(const char *name)
+{
+
+	return (mm_heap_stats_export(&default_heap, name));
+}
+
+/*
+ * Requires:
+ *   "name" is NULL or a POSIX shared memory object name, e.g., "/mm.42".
+ *
+ * Effects:
+ *   Publish the heap's statistics in a new shared memory object "name",
+ *   replacing the object it was exported to before, if any.  NULL stops
+ *   exporting.  Returns 0 on success and -1 otherwise, in which case the
+ *   heap is no longer exported.
+ */
+int
+mm_heap_stats_export(mm_heap_t *heap, const char *name)
+{
+	struct mmstat_page *sp;
+	struct node *nodep;
+	int bin, life;
+
+	heap_lock(heap);
+	stats_unmap(heap);
+	if (name == NULL) {
+		heap_unlock(heap);
+		return (0);
+	}
+	if ((sp = mem_shared_create(name, sizeof(*sp))) == NULL) {
+		heap_unlock(heap);
+		return (-1);
+	}
+	if ((heap->stats_name = strdup(name)) == NULL) {
+		mem_shared_destroy(name, sp, sizeof(*sp));
+		heap_unlock(heap);
+		return (-1);
+	}
+
+	/* Count the free blocks once; the lists keep the counts from now on. */
+	for (bin = 0; bin < NBINS; bin++) {
+		heap->stats_blocks[bin] = heap->stats_bytes[bin] = 0;
+		for (life = 0; life < NLIFE; life++) {
+			for (nodep = heap->list_start[life][bin]; nodep != NULL;
+			    nodep = NEXT(nodep)) {
+				heap->stats_blocks[bin]++;
+				heap->stats_bytes[bin] += GET_SIZE(HDRP(nodep));
+			}
+		}
+	}
+	heap->nallocs = heap->nfrees = 0;
+	sp->nbins = NBINS;
+	sp->pid = getpid();
+	heap->stats = sp;
+	stats_publish(heap);
+	sp->magic = MMSTAT_MAGIC;
+	heap_unlock(heap);
+	return (0);
+}
+
+/*
+ * Requires:
+ *   The heap is exported and the caller holds its lock.
+ *
+ * Effects:
+ *   Count one request, publishing the statistics every STATSOPS requests.
+ */
+static void
+stats_tick(struct mm_heap *heap)
+{
+
+	if ((heap->nallocs + heap->nfrees) % STATSOPS == 0)
+		stats_publish(heap);
+}
+
+/*
+ * Requires:
+ *   The heap is exported and the caller holds its lock.
+ *
+ * Effects:
+ *   Copy the heap's statistics to its shared page, inside a seqlock write.
+ */
+static void
+stats_publish(struct mm_heap *heap)
+{
+	struct mmstat_page *sp = heap->stats;
+	size_t size = mem_region_size(heap->region), free_bytes = 0, top = 0;
+	uint64_t seq = atomic_load_explicit(&sp->seq, memory_order_relaxed);
+	int bin;
+
+	atomic_store_explicit(&sp->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (bin = 0; bin < NBINS; bin++) {
+		atomic_store_explicit(&sp->free_blocks[bin],
+		    heap->stats_blocks[bin], memory_order_relaxed);
+		atomic_store_explicit(&sp->free_bytes[bin],
+		    heap->stats_bytes[bin], memory_order_relaxed);
+		free_bytes += heap->stats_bytes[bin];
+	}
+	if (heap->top != NULL)
+		top = GET_SIZE(HDRP(heap->top));
+	atomic_store_explicit(&sp->heap_size, size, memory_order_relaxed);
+	atomic_store_explicit(&sp->live_bytes, size - free_bytes - top,
+	    memory_order_relaxed);
+	atomic_store_explicit(&sp->top_bytes, top, memory_order_relaxed);
+	atomic_store_explicit(&sp->sbrk_calls, heap->nsbrk,
+	    memory_order_relaxed);
+	atomic_store_explicit(&sp->allocs, heap->nallocs,
+	    memory_order_relaxed);
+	atomic_store_explicit(&sp->frees, heap->nfrees, memory_order_relaxed);
+	atomic_store_explicit(&sp->seq, seq + 2, memory_order_release);
+}
+
+/*
+ * Requires:
+ *   The caller holds the heap's lock, if it has one.
+ *
+ * Effects:
+ *   Stop exporting the heap's statistics, removing their shared memory
+ *   object.
+ */
+static void
+stats_unmap(struct mm_heap *heap)
+{
+
+	if (heap->stats == NULL)
+		return;
+	mem_shared_destroy(heap->stats_name, heap->stats,
+	    sizeof(*heap->stats));
+	free(heap->stats_name);
+	heap->stats = NULL;
+	heap->stats_name = NULL;
+}
+
+/*
+ * The following routines implement the front-end caches.  Requests for
+ * blocks of up to class_sizes[NCLASSES - 1] bytes are rounded up to a
+ * class size and served from a cache without locking the default heap.
+ * A cache that runs dry takes CACHEBATCH blocks from the heap, and one
+ * that fills up gives CACHEBATCH back, under one lock acquisition.
+ *
+ * Between the caches and the heap sits a transfer cache per class, so
+ * that a batch flushed by one cache, e.g., that of a thread freeing what
+ * another allocates, can refill another with a single copy under the
+ * class's own lock rather than a trip through the heap's free lists.
+ *
+ * With MM_CACHE_CPU, a request uses the cache of the CPU it runs on, as
+ * read from the kernel's restartable sequences area (rseq) when glibc
+ * has registered one, and from sched_getcpu() otherwise.  Since a thread
+ * may be preempted while it uses a CPU's cache, the cache is taken with
+ * an atomic flag; a request that still finds it taken after yielding
+ * the CPU goes to the heap.
+ */
+
+/*
+ * Requires:
+ *   "mode" is MM_CACHE_NONE, MM_CACHE_THREAD or MM_CACHE_CPU, and no
+ *   other thread is using the allocator.
+ *
+ * Effects:
+ *   Put front-end caches of the given kind in front of the default heap,
+ *   returning the blocks in any previous caches to it.  Any cache other
+ *   than MM_CACHE_NONE makes the default heap safe to use from several
+ *   threads at once.  Returns 0 on success and -1 otherwise.
+ */
+int
+mm_cache_enable(int mode)
+{
+	int i;
+
+	if (cache_mode != MM_CACHE_NONE) {
+		cache_drop(true);
+		free(cpu_caches);
+		cpu_caches = NULL;
+		cache_mode = MM_CACHE_NONE;
+		heap_unshare(&default_heap);
+	}
+	if (mode == MM_CACHE_NONE)
+		return (0);
+
+	pthread_once(&cache_once, cache_setup);
+	if (heap_share(&default_heap) < 0)
+		return (-1);
+	if (mode == MM_CACHE_CPU) {
+		ncpu_caches = (int)sysconf(_SC_NPROCESSORS_CONF);
+		if (ncpu_caches < 1)
+			ncpu_caches = 1;
+		cpu_caches = aligned_alloc(_Alignof(struct mm_cache),
+		    ncpu_caches * sizeof(struct mm_cache));
+		if (cpu_caches == NULL) {
+			heap_unshare(&default_heap);
+			return (-1);
+		}
+		memset(cpu_caches, 0, ncpu_caches * sizeof(struct mm_cache));
+		for (i = 0; i < ncpu_caches; i++)
+			atomic_flag_clear(&cpu_caches[i].busy);
+	}
+	cache_mode = mode;
+	return (0);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the bytes of free blocks held in front-end caches, i.e., the
+ *   memory that the caches cost.  The count is approximate while other
+ *   threads are allocating.
+ */
+size_t
+mm_cache_bytes(void)
+{
+	struct mm_cache *c;
+	size_t bytes = 0;
+	int cls, i;
+
+	pthread_mutex_lock(&all_caches_lock);
+	for (c = all_caches; c != NULL; c = c->next)
+		for (cls = 0; cls < NCLASSES; cls++)
+			bytes += c->count[cls] * class_sizes[cls];
+	pthread_mutex_unlock(&all_caches_lock);
+	for (i = 0; cpu_caches != NULL && i < ncpu_caches; i++)
+		for (cls = 0; cls < NCLASSES; cls++)
+			bytes += cpu_caches[i].count[cls] * class_sizes[cls];
+	for (cls = 0; cls < NCLASSES; cls++) {
+		pthread_mutex_lock(&xfer_caches[cls].lock);
+		bytes += xfer_caches[cls].nbatches * CACHEBATCH *
+		    class_sizes[cls];
+		pthread_mutex_unlock(&xfer_caches[cls].lock);
+	}
+	return (bytes);
+}
+
+/*
+ * Requires:
+ *   The caches are enabled.
+ *
+ * Effects:
+ *   mm_malloc() through the caller's cache.
+ */
+static void *
+cache_malloc(size_t size)
+{
+	struct mm_cache *c;
+	size_t asize;
+	int cls;
+	void *bp;
+
+	if (size == 0)
+		return (NULL);
+	asize = adjust_size(size);
+	if (asize > class_sizes[NCLASSES - 1])
+		return (mm_heap_malloc(&default_heap, size));
+	cls = class_table[asize / ASIZE];
+
+	/* Without a cache to use, allocate a block of the class size. */
+	if ((c = cache_get()) == NULL) {
+		asize = class_sizes[cls];
+		heap_lock(&default_heap);
+		bp = malloc_class(&default_heap, asize, find_bin(asize),
+		    lifetime_table[find_bin(asize)]);
+		heap_unlock(&default_heap);
+		return (bp);
+	}
+	if (c->count[cls] == 0 && cache_refill(c, cls) == 0)
+		bp = NULL;
+	else {
+		bp = c->slots[cls][--c->count[cls]];
+		set_cached(bp, false);
+	}
+	cache_put(c);
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   The caches are enabled and "bp" is the address of an allocated block.
+ *
+ * Effects:
+ *   mm_free() through the caller's cache.  Only blocks of exactly a class
+ *   size are cached, so that every cached block fits every request of its
+ *   class; any other block goes straight back to the heap.
+ */
+static void
+cache_free(void *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+	struct mm_cache *c;
+	int cls;
+
+	if (size > class_sizes[NCLASSES - 1] || GET_OWNER(HDRP(bp)) != 0 ||
+	    class_sizes[cls = class_table[size / ASIZE]] != size ||
+	    (c = cache_get()) == NULL) {
+		mm_heap_free(&default_heap, bp);
+		return;
+	}
+	check_free(bp);
+	set_cached(bp, true);
+	if (c->count[cls] == CACHESLOTS)
+		cache_flush(c, cls, CACHEBATCH);
+	c->slots[cls][c->count[cls]++] = bp;
+	cache_put(c);
+}
+
+/*
+ * Requires:
+ *   The caches are enabled.
+ *
+ * Effects:
+ *   Returns the cache for the calling thread to use, or NULL if there is
+ *   none free or none could be created.
+ */
+static struct mm_cache *
+cache_get(void)
+{
+	struct mm_cache *c;
+
+	if (cache_mode == MM_CACHE_THREAD) {
+		if (thread_cache == NULL)
+			thread_cache = cache_create();
+		return (thread_cache);
+	}
+	c = &cpu_caches[current_cpu() % ncpu_caches];
+	if (!atomic_flag_test_and_set_explicit(&c->busy, memory_order_acquire))
+		return (c);
+
+	/*
+	 * The thread holding the cache was most likely preempted on this CPU,
+	 * so let it run and finish before trying once more.
+	 */
+	sched_yield();
+	c = &cpu_caches[current_cpu() % ncpu_caches];
+	if (!atomic_flag_test_and_set_explicit(&c->busy, memory_order_acquire))
+		return (c);
+	return (NULL);
+}
+
+/*
+ * Requires:
+ *   "c" was returned by cache_get().
+ *
+ * Effects:
+ *   Let other threads use "c" again.
+ */
+static void
+cache_put(struct mm_cache *c)
+{
+
+	if (cache_mode == MM_CACHE_CPU)
+		atomic_flag_clear_explicit(&c->busy, memory_order_release);
+}
+
+/*
+ * Requires:
+ *   The calling thread has no cache.
+ *
+ * Effects:
+ *   Create an empty cache for the calling thread, to be flushed when the
+ *   thread exits.  Returns the cache or NULL if there is no memory.
+ */
+static struct mm_cache *
+cache_create(void)
+{
+	struct mm_cache *c;
+
+	if ((c = aligned_alloc(_Alignof(struct mm_cache), sizeof(*c))) == NULL)
+		return (NULL);
+	memset(c, 0, sizeof(*c));
+	pthread_mutex_lock(&all_caches_lock);
+	c->next = all_caches;
+	all_caches = c;
+	pthread_mutex_unlock(&all_caches_lock);
+	pthread_setspecific(cache_key, c);
+	return (c);
+}
+
+/*
+ * Requires:
+ *   "arg" is the exiting thread's cache.
+ *
+ * Effects:
+ *   Return the cache's blocks to the default heap and release the cache.
+ */
+static void
+cache_exit(void *arg)
+{
+	struct mm_cache *c = arg, **cp;
+	int cls;
+
+	for (cls = 0; cls < NCLASSES; cls++)
+		cache_flush(c, cls, c->count[cls]);
+	pthread_mutex_lock(&all_caches_lock);
+	for (cp = &all_caches; *cp != c; cp = &(*cp)->next)
+		continue;
+	*cp = c->next;
+	pthread_mutex_unlock(&all_caches_lock);
+	free(c);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Build the block size to class table, the transfer caches' locks, and
+ *   the key whose destructor flushes a thread's cache.
+ */
+static void
+cache_setup(void)
+{
+	size_t size;
+	int cls = 0;
+
+	for (size = 0; size <= class_sizes[NCLASSES - 1]; size += ASIZE) {
+		while (class_sizes[cls] < size)
+			cls++;
+		class_table[size / ASIZE] = cls;
+	}
+	for (cls = 0; cls < NCLASSES; cls++)
+		pthread_mutex_init(&xfer_caches[cls].lock, NULL);
+	pthread_key_create(&cache_key, cache_exit);
+}
+
+/*
+ * Requires:
+ *   "c" is empty in class "cls" and taken by the caller.
+ *
+ * Effects:
+ *   Fill "c" with up to CACHEBATCH blocks of the class size, a batch from
+ *   the transfer cache if it has one.  Returns the number of blocks it
+ *   got.
+ */
+static int
+cache_refill(struct mm_cache *c, int cls)
+{
+	struct mm_xfer *x = &xfer_caches[cls];
+	size_t asize = class_sizes[cls];
+	int bin = find_bin(asize);
+	void *bp;
+
+	pthread_mutex_lock(&x->lock);
+	if (x->nbatches > 0) {
+		memcpy(c->slots[cls], x->batches[--x->nbatches],
+		    sizeof(x->batches[0]));
+		pthread_mutex_unlock(&x->lock);
+		return (c->count[cls] = CACHEBATCH);
+	}
+	pthread_mutex_unlock(&x->lock);
+
+	heap_lock(&default_heap);
+	while (c->count[cls] < CACHEBATCH && (bp = malloc_class(&default_heap,
+	    asize, bin, lifetime_table[bin])) != NULL)
+		c->slots[cls][c->count[cls]++] = bp;
+	heap_unlock(&default_heap);
+	return (c->count[cls]);
+}
+
+/*
+ * Requires:
+ *   "c" holds at least "n" blocks of class "cls" and is taken by the
+ *   caller.
+ *
+ * Effects:
+ *   Release the "n" most recently cached blocks of class "cls": as a
+ *   batch to the transfer cache if they make up a batch and it has room,
+ *   and to the heap otherwise.
+ */
+static void
+cache_flush(struct mm_cache *c, int cls, int n)
+{
+	struct mm_xfer *x = &xfer_caches[cls];
+
+	if (n == 0)
+		return;
+	if (n == CACHEBATCH) {
+		pthread_mutex_lock(&x->lock);
+		if (x->nbatches < XFERBATCHES) {
+			c->count[cls] -= CACHEBATCH;
+			memcpy(x->batches[x->nbatches++],
+			    &c->slots[cls][c->count[cls]],
+			    sizeof(x->batches[0]));
+			pthread_mutex_unlock(&x->lock);
+			return;
+		}
+		pthread_mutex_unlock(&x->lock);
+	}
+	heap_lock(&default_heap);
+	while (n-- > 0)
+		free_block(&default_heap, c->slots[cls][--c->count[cls]]);
+	heap_unlock(&default_heap);
+}
+
+/*
+ * Requires:
+ *   No other thread is using the allocator.
+ *
+ * Effects:
+ *   Empty every cache, transfer caches included, returning its blocks to
+ *   the heap if "flush" is set and forgetting them otherwise, e.g., before
+ *   mm_init() reuses the old heap's memory.  Forgotten blocks lose their
+ *   cache marks, which would otherwise turn up in new blocks.
+ */
+static void
+cache_drop(bool flush)
+{
+	struct mm_cache *c;
+	struct mm_xfer *x;
+	int cls, i, j;
+
+	for (c = all_caches; c != NULL; c = c->next) {
+		for (cls = 0; cls < NCLASSES; cls++) {
+			if (flush)
+				cache_flush(c, cls, c->count[cls]);
+			while (c->count[cls] > 0)
+				set_cached(c->slots[cls][--c->count[cls]],
+				    false);
+		}
+	}
+	for (i = 0; cpu_caches != NULL && i < ncpu_caches; i++) {
+		c = &cpu_caches[i];
+		for (cls = 0; cls < NCLASSES; cls++) {
+			if (flush)
+				cache_flush(c, cls, c->count[cls]);
+			while (c->count[cls] > 0)
+				set_cached(c->slots[cls][--c->count[cls]],
+				    false);
+		}
+	}
+	heap_lock(&default_heap);
+	for (cls = 0; cls < NCLASSES; cls++) {
+		x = &xfer_caches[cls];
+		for (; x->nbatches > 0; x->nbatches--) {
+			for (j = 0; j < CACHEBATCH; j++) {
+				if (flush)
+					free_block(&default_heap,
+					    x->batches[x->nbatches - 1][j]);
+				else
+					set_cached(x->batches[x->nbatches - 1]
+					    [j], false);
+			}
+		}
+	}
+	heap_unlock(&default_heap);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the CPU the calling thread is running on, or 0 if it cannot
+ *   be told.
+ */
+static int
+current_cpu(void)
+{
+	int cpu;
+
+#ifdef HAVE_RSEQ
+	if (__rseq_size > 0)
+		return ((int)*(volatile uint32_t *)&((struct rseq *)
+		    ((char *)__builtin_thread_pointer() + __rseq_offset))->
+		    cpu_id);
+#endif
+	cpu = sched_getcpu();
+	return (cpu < 0 ? 0 : cpu);
+}
+
+/*
+ * Requires:
+ *   No other thread is using "heap".
+ *
+ * Effects:
+ *   Make every request on "heap" take its lock, until a matching
+ *   heap_unshare().  Returns 0 on success and -1 otherwise.
+ */
+static int
+heap_share(struct mm_heap *heap)
+{
+
+	if (heap->lockers == 0 && pthread_mutex_init(&heap->lock, NULL) != 0)
+		return (-1);
+	heap->lockers++;
+	return (0);
+}
+
+/*
+ * Requires:
+ *   No other thread is using "heap", and it was shared by heap_share().
+ *
+ * Effects:
+ *   Undo one heap_share().
+ */
+static void
+heap_unshare(struct mm_heap *heap)
+{
+
+	if (--heap->lockers == 0)
+		pthread_mutex_destroy(&heap->lock);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Take "heap"'s lock if it is shared.
+ */
+static void
+heap_lock(struct mm_heap *heap)
+{
+
+	if (heap->lockers > 0)
+		pthread_mutex_lock(&heap->lock);
+}
+
+/*
+ * Requires:
+ *   The caller took "heap"'s lock with heap_lock().
+ *
+ * Effects:
+ *   Release "heap"'s lock if it is shared.
+ */
+static void
+heap_unlock(struct mm_heap *heap)
+{
+
+	if (heap->lockers > 0)
+		pthread_mutex_unlock(&heap->lock);
+}
+
+/*
+ * The following routines manage tiny pages.  A tiny page is carved out of
+ * an ordinary allocated block, so it counts towards the heap like any
+ * other block and goes back to the free lists once all of its slots are
+ * free again, unless it is the last tiny page with free slots of its size.
+ */
+
+/*
+ * Requires:
+ *   "size" is not zero and at most TINYMAX, and "heap" is locked.
+ *
+ * Effects:
+ *   Allocate a slot for "size" bytes from a tiny page.  Returns the
+ *   address of the slot or NULL if no tiny page could be created.
+ */
+static void *
+tiny_malloc(struct mm_heap *heap, size_t size, int tag)
+{
+	struct tiny_page *tp;
+	int i, t = size > ASIZE;
+
+	if ((tp = heap->tiny_pages[tag][t]) == NULL &&
+	    (tp = tiny_page_create(heap, t, tag)) == NULL)
+		return (NULL);
+
+	/* Take the first free slot, and retire the page once it is full. */
+	for (i = 0; tp->map[i] == 0; i++)
+		continue;
+	i = 64 * i + __builtin_ctzll(tp->map[i]);
+	tp->map[i / 64] &= ~((uint64_t)1 << (i % 64));
+	if (--tp->nfree == 0) {
+		heap->tiny_pages[tag][t] = tp->next;
+		if (tp->next != NULL)
+			tp->next->prev = NULL;
+	}
+	if (tag != 0)
+		tag_count(heap, tag, tp->size, 1);
+	if (heap->stats != NULL) {
+		heap->nallocs++;
+		stats_tick(heap);
+	}
+	return ((char *)tp + i * tp->size);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a slot allocated from a tiny page of "heap",
+ *   and "heap" is locked.
+ *
+ * Effects:
+ *   Free the slot "bp", and the whole tiny page if it is now empty and
+ *   another page has free slots of its size.
+ */
+static void
+tiny_free(struct mm_heap *heap, void *bp)
+{
+	struct tiny_page *tp = TINY_PAGE(heap, bp);
+	size_t i = ((char *)bp - (char *)tp) / tp->size;
+	int t = tp->size > ASIZE;
+
+#ifdef MM_HARDENED
+	if (((char *)bp - (char *)tp) % tp->size != 0 ||
+	    (tp->map[i / 64] & ((uint64_t)1 << (i % 64))) != 0)
+		corrupt("double free", bp);
+#endif
+	tp->map[i / 64] |= (uint64_t)1 << (i % 64);
+	if (tp->owner != 0)
+		tag_count(heap, tp->owner, -(ptrdiff_t)tp->size, -1);
+	if (heap->stats != NULL) {
+		heap->nfrees++;
+		stats_tick(heap);
+	}
+
+	/* A full page is not on its list; put it back at the front. */
+	if (tp->nfree++ == 0) {
+		tp->prev = NULL;
+		tp->next = heap->tiny_pages[tp->owner][t];
+		if (tp->next != NULL)
+			tp->next->prev = tp;
+		heap->tiny_pages[tp->owner][t] = tp;
+	}
+
+	if (tp->nfree < tp->capacity || (tp->prev == NULL && tp->next == NULL))
+		return;
+
+	/* Every slot is free: give the page back to the heap. */
+	if (tp->prev != NULL)
+		tp->prev->next = tp->next;
+	else
+		heap->tiny_pages[tp->owner][t] = tp->next;
+	if (tp->next != NULL)
+		tp->next->prev = tp->prev;
+	heap->tiny_map[PAGE_OF(heap, tp)] = 0;
+	free_block(heap, tp);
+}
+
+/*
+ * Requires:
+ *   "t" is a tiny slot size index and "heap" is locked.
+ *
+ * Effects:
+ *   Carve a page-aligned block of one page out of a larger block, give
+ *   the rest of that block back, and set the page up as the only tiny page
+ *   with free slots of size 8 << t, coloured with the next colour.
+ *   Returns the page or NULL if the heap is out of memory.
+ */
+static struct tiny_page *
+tiny_page_create(struct mm_heap *heap, int t, int tag)
+{
+	size_t pagesize = heap->pagesize;
+	size_t asize = 2 * pagesize + DSIZE + ASIZE + QSIZE;
+	size_t size, lead, slots, first, i;
+	struct tiny_page *tp;
+	char *bp, *page;
+
+	if ((bp = malloc_class(heap, asize, find_bin(asize), LIFE_LONG)) ==
+	    NULL)
+		return (NULL);
+	size = GET_SIZE(HDRP(bp));
+
+	/* Leave room for a free block before the page, unless there is none. */
+	page = (char *)(((uintptr_t)bp + pagesize - 1) & ~(pagesize - 1));
+	if (page != bp && (size_t)(page - bp) < ASIZE + QSIZE)
+		page += pagesize;
+	lead = page - bp;
+	PUT(HDRP(page), PACK_LIFE(size - lead, 1, LIFE_LONG));
+	PUT(FTRP(page), PACK_LIFE(size - lead, 1, LIFE_LONG));
+	if (lead > 0) {
+		PUT(HDRP(bp), PACK_LIFE(lead, 1, LIFE_LONG));
+		PUT(FTRP(bp), PACK_LIFE(lead, 1, LIFE_LONG));
+		free_block(heap, bp);
+	}
+	if (size - lead - (pagesize + DSIZE) >= ASIZE + QSIZE) {
+		PUT(HDRP(page), PACK_LIFE(pagesize + DSIZE, 1, LIFE_LONG));
+		PUT(FTRP(page), PACK_LIFE(pagesize + DSIZE, 1, LIFE_LONG));
+		bp = NEXT_PHYS_BLKP(page);
+		PUT(HDRP(bp), PACK_LIFE(size - lead - (pagesize + DSIZE), 1,
+		    LIFE_LONG));
+		PUT(FTRP(bp), PACK_LIFE(size - lead - (pagesize + DSIZE), 1,
+		    LIFE_LONG));
+		free_block(heap, bp);
+	}
+
+	/*
+	 * Mark every slot past the header and the page's colour free.  The
+	 * colour keeps the first slots of all tiny pages, which are the
+	 * first to be handed out, from competing for the same cache sets.
+	 */
+	tp = (struct tiny_page *)page;
+	tp->size = ASIZE << t;
+	slots = pagesize / tp->size;
+	memset(tp->map, 0, (slots + 63) / 64 * sizeof(tp->map[0]));
+	first = ((char *)&tp->map[(slots + 63) / 64] - page + tp->size - 1) /
+	    tp->size + heap->tiny_colour[t]++ % TINYCOLOURS * CACHELINE /
+	    tp->size;
+	for (i = first; i < slots; i++)
+		tp->map[i / 64] |= (uint64_t)1 << (i % 64);
+	tp->nfree = tp->capacity = slots - first;
+	tp->owner = tag;
+	tp->next = tp->prev = NULL;
+	heap->tiny_pages[tag][t] = tp;
+	heap->tiny_map[PAGE_OF(heap, page)] = 1;
+	return (tp);
+}
+
+/*
+ * The following routines manage the page sub-heap.  It hands out runs of
+ * whole pages from a region of its own, so page buffers never share a
+ * page with ordinary blocks.  Its boundary tags live in an array at the
+ * start of the region, one word per page, rather than in the pages.
+ */
+
+/*
+ * Requires:
+ *   "npages" is not zero.
+ *
+ * Effects:
+ *   Allocate a run of "npages" page-aligned pages.  If "flags" includes
+ *   MM_PAGES_PREFAULT, the pages are faulted in before they are returned.
+ *   Returns the address of the first page or NULL if the allocation
+ *   failed.
+ */
+void *
+mm_alloc_pages(size_t npages, int flags)
+{
+	struct page_heap *ph = &page_heap;
+	size_t psize;
+	char *bp;
+
+	if (npages == 0)
+		return (NULL);
+	pthread_mutex_lock(&page_heap_lock);
+	if ((ph->region == NULL && page_heap_init(ph) < 0) ||
+	    npages > SIZE_MAX / ph->pagesize) {
+		pthread_mutex_unlock(&page_heap_lock);
+		return (NULL);
+	}
+	psize = npages * ph->pagesize;
+
+	/* Search the free runs for a fit; grow the sub-heap if none fits. */
+	if ((bp = page_find_fit(ph, psize)) == NULL &&
+	    (bp = page_extend(ph, psize)) == NULL) {
+		pthread_mutex_unlock(&page_heap_lock);
+		return (NULL);
+	}
+	page_place(ph, bp, psize);
+	pthread_mutex_unlock(&page_heap_lock);
+
+	if (flags & MM_PAGES_PREFAULT)
+		mem_prefault(bp, psize);
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   "ptr" is either an address returned by mm_alloc_pages() or NULL.
+ *
+ * Effects:
+ *   Return a run of pages to the page sub-heap.  The pages stay mapped, so
+ *   a later mm_alloc_pages() of the same size reuses them.
+ */
+void
+mm_free_pages(void *ptr)
+{
+	struct page_heap *ph = &page_heap;
+
+	if (ptr == NULL)
+		return;
+	pthread_mutex_lock(&page_heap_lock);
+	PUT(PAGE_HDRP(ph, ptr), PACK(GET_SIZE(PAGE_HDRP(ph, ptr)), 0));
+	PUT(PAGE_FTRP(ph, ptr), PACK(GET_SIZE(PAGE_HDRP(ph, ptr)), 0));
+	page_coalesce(ph, ptr);
+	pthread_mutex_unlock(&page_heap_lock);
+}
+
+/*
+ * Requires:
+ *   "ph" has no region yet.
+ *
+ * Effects:
+ *   Create the page sub-heap's region and its tag array.  Returns 0 on
+ *   success and -1 otherwise.
+ */
+static int
+page_heap_init(struct page_heap *ph)
+{
+	size_t tagsize;
+
+#ifdef MM_HARDENED
+	pthread_once(&mm_secret_once, secret_init);
+#endif
+	ph->pagesize = mem_pagesize();
+	ph->max_pages = PAGEHEAPSIZE / ph->pagesize;
+	if ((ph->region = mem_region_create(PAGEHEAPSIZE)) == NULL)
+		return (-1);
+
+	/* The tags take up the first pages; runs start after them. */
+	tagsize = ph->max_pages * WSIZE;
+	tagsize = ph->pagesize * ((tagsize + ph->pagesize - 1) / ph->pagesize);
+	if ((ph->tags = mem_region_sbrk(ph->region, tagsize)) == (void *)-1) {
+		mem_region_destroy(ph->region);
+		ph->region = NULL;
+		return (-1);
+	}
+	ph->base = (char *)ph->tags + tagsize;
+	ph->npages = 0;
+	ph->free_runs = NULL;
+	return (0);
+}
+
+/*
+ * Requires:
+ *   "psize" is a multiple of the page size.
+ *
+ * Effects:
+ *   Find the first free run of at least "psize" bytes.  Returns that run's
+ *   address or NULL if no run is large enough.
+ */
+static void *
+page_find_fit(struct page_heap *ph, size_t psize)
+{
+	struct node *cur;
+
+	for (cur = ph->free_runs; cur != NULL; cur = NEXT(cur)) {
+		if (psize <= GET_SIZE(PAGE_HDRP(ph, cur)))
+			return (cur);
+	}
+	return (NULL);
+}
+
+/*
+ * Requires:
+ *   "psize" is a multiple of the page size.
+ *
+ * Effects:
+ *   Grow the sub-heap by at least "psize" bytes of free pages, merging them
+ *   with a free run at the old end.  Returns the resulting free run or NULL
+ *   if the sub-heap is full.
+ */
+static void *
+page_extend(struct page_heap *ph, size_t psize)
+{
+	char *bp;
+
+	if (ph->npages + psize / ph->pagesize > ph->max_pages)
+		return (NULL);
+	if ((bp = mem_region_sbrk(ph->region, psize)) == (void *)-1)
+		return (NULL);
+	ph->npages += psize / ph->pagesize;
+	PUT(PAGE_HDRP(ph, bp), PACK(psize, 0));
+	PUT(PAGE_FTRP(ph, bp), PACK(psize, 0));
+	return (page_coalesce(ph, bp));
+}
+
+/*
+ * Requires:
+ *   "bp" is a free run of at least "psize" bytes.
+ *
+ * Effects:
+ *   Allocate the first "psize" bytes of "bp", returning the rest of the run
+ *   to the free runs.
+ */
+static void
+page_place(struct page_heap *ph, void *bp, size_t psize)
+{
+	size_t csize = GET_SIZE(PAGE_HDRP(ph, bp));
+	char *rest;
+
+	page_splice(ph, bp);
+	PUT(PAGE_HDRP(ph, bp), PACK(psize, 1));
+	PUT(PAGE_FTRP(ph, bp), PACK(psize, 1));
+	if (csize > psize) {
+		rest = (char *)bp + psize;
+		PUT(PAGE_HDRP(ph, rest), PACK(csize - psize, 0));
+		PUT(PAGE_FTRP(ph, rest), PACK(csize - psize, 0));
+		page_add(ph, rest);
+	}
+}
+
+/*
+ * Requires:
+ *   "bp" is a free run that is not on the free runs list.
+ *
+ * Effects:
+ *   Merge "bp" with free neighbouring runs and put the result on the free
+ *   runs list.  Returns the address of the merged run.
+ */
+static void *
+page_coalesce(struct page_heap *ph, void *bp)
+{
+	size_t size = GET_SIZE(PAGE_HDRP(ph, bp));
+	uintptr_t *prev_ftr;
+	char *next = (char *)bp + size;
+
+	/* Merge with the following run. */
+	if (PAGE_INDEX(ph, next) < ph->npages &&
+	    !GET_ALLOC(PAGE_HDRP(ph, next))) {
+		page_splice(ph, next);
+		size += GET_SIZE(PAGE_HDRP(ph, next));
+	}
+
+	/* Merge with the preceding run. */
+	if (bp != ph->base && !GET_ALLOC(prev_ftr = PAGE_HDRP(ph, bp) - 1)) {
+		bp = (char *)bp - GET_SIZE(prev_ftr);
+		page_splice(ph, bp);
+		size += GET_SIZE(PAGE_HDRP(ph, bp));
+	}
+
+	PUT(PAGE_HDRP(ph, bp), PACK(size, 0));
+	PUT(PAGE_FTRP(ph, bp), PACK(size, 0));
+	page_add(ph, bp);
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   "bp" is a free run that is not on the free runs list.
+ *
+ * Effects:
+ *   Put "bp" at the front of the free runs list.
+ */
+static void
+page_add(struct page_heap *ph, void *bp)
+{
+	struct node *nodep = (struct node *)bp;
+
+	SET_NEXT(nodep, ph->free_runs);
+	SET_PREV(nodep, NULL);
+	if (ph->free_runs != NULL)
+		SET_PREV(ph->free_runs, nodep);
+	ph->free_runs = nodep;
+}
+
+/*
+ * Requires:
+ *   "bp" is a free run on the free runs list.
+ *
+ * Effects:
+ *   Remove "bp" from the free runs list.
+ */
+static void
+page_splice(struct page_heap *ph, void *bp)
+{
+	struct node *nodep = (struct node *)bp;
+	struct node *next = NEXT(nodep), *prev = PREV(nodep);
+
+#ifdef MM_HARDENED
+	if (!LINK_OK(ph->base, ph->base + ph->max_pages * ph->pagesize,
+	    next) ||
+	    !LINK_OK(ph->base, ph->base + ph->max_pages * ph->pagesize,
+	    prev) ||
+	    (next != NULL && PREV(next) != nodep) ||
+	    (prev != NULL ? NEXT(prev) : ph->free_runs) != nodep)
+		corrupt("broken free run list at", nodep);
+#endif
+	if (prev != NULL)
+		SET_NEXT(prev, next);
+	else
+		ph->free_runs = next;
+	if (next != NULL)
+		SET_PREV(next, prev);
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+/*
+ * Requires:
+ *   "region" is empty except for, possibly, "heap" itself.
+ *
+ * Effects:
+ *   Lay out an empty heap in "region".  Returns 0 on success and -1 if the
+ *   region is too small.
+ */
+static int
+heap_init(struct mm_heap *heap, mem_region_t *region)
+{
+	char *bp;
+	int bin, life, t;
+
+#ifdef MM_HARDENED
+	pthread_once(&mm_secret_once, secret_init);
+#endif
+	heap->region = region;
+	heap->limit = (char *)mem_region_lo(region) + mem_region_maxsize(region);
+	heap->pagesize = mem_pagesize();
+	if (heap->tiny_map == NULL && (heap->tiny_map =
+	    malloc(mem_region_maxsize(region) / heap->pagesize + 1)) == NULL)
+		return (-1);
+	memset(heap->tiny_map, 0, mem_region_maxsize(region) /
+	    heap->pagesize + 1);
+	memset(heap->tiny_pages, 0, sizeof(heap->tiny_pages));
+	memset(heap->tag_bytes, 0, sizeof(heap->tag_bytes));
+	memset(heap->tag_blocks, 0, sizeof(heap->tag_blocks));
+	for (t = 0; t < NTINY; t++)
+		heap->tiny_colour[t] = 0;
+	if (heap->dirty_map != NULL) {
+		memset(heap->dirty_map, PAGE_USED, mem_region_maxsize(region) /
+		    heap->pagesize + 1);
+		decay_reset(heap);
+	}
+	if (heap->near_map != NULL)
+		memset(heap->near_map, 0, (mem_region_maxsize(region) /
+		    heap->pagesize + 1) * sizeof(*heap->near_map));
+
+	/* Create the initial empty heap. */
+	if ((bp = mem_region_sbrk(region, 3 * WSIZE)) == (void *)-1)
+		return (-1);
+	heap->nsbrk = 1;
+	PUT(bp, PACK(DSIZE, 1));               /* Prologue header */
+	PUT(bp + (1 * WSIZE), PACK(DSIZE, 1)); /* Prologue footer */
+	PUT(bp + (2 * WSIZE), PACK(0, 1));     /* Epilogue header */
+	heap->heap_listp = bp + WSIZE;
+	heap->top = NULL;
+
+	/* Every free list starts out empty. */
+	for (life = 0; life < NLIFE; life++)
+		for (bin = 0; bin < NBINS; bin++)
+			heap->list_start[life][bin] = NULL;
+	for (bin = 0; bin < NBINS; bin++)
+		heap->stats_blocks[bin] = heap->stats_bytes[bin] = 0;
+#ifdef MM_INDEX
+	pthread_once(&index_once, index_setup);
+	for (life = 0; life < NLIFE; life++)
+		for (bin = 0; bin < NBINS; bin++)
+			heap->index[life][bin].n = 0;
+	heap->index_ok = true;
+#endif
+
+	/* Extend the empty heap with a free block of CHUNKSIZE bytes. */
+	if (extend_heap(heap, CHUNKSIZE / WSIZE, LIFE_LONG) == NULL)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Requires:
+ *   "bin" is the size class of "asize" and "life" is a lifetime class.
+ *
+ * Effects:
+ *   Allocate a block of "asize" bytes from "heap", preferring free blocks
+ *   of lifetime class "life", then the top, and extending the heap if
+ *   nothing fits.  Returns the address of this block if the
+ *   allocation was successful and NULL otherwise.
+ */
+static void *
+malloc_class(struct mm_heap *heap, size_t asize, int bin, int life)
+{
+	size_t extendsize; /* Amount to extend heap if no fit */
+	void *bp;
+
+	/* Search the free lists and the top for a fit. */
+	if ((bp = fit(heap, asize, bin, life)) != NULL) {
+		place(heap, bp, asize, life);
+		return (bp);
+	}
+
+	/*
+	 * Before growing the heap, coalesce the blocks the consolidator has
+	 * not reached yet; one of them may fit.
+	 */
+	if (heap->deferred && atomic_load(&heap->pending) != NULL) {
+		free_pending(heap, atomic_exchange(&heap->pending, NULL), -1);
+		if ((bp = fit(heap, asize, bin, life)) != NULL) {
+			place(heap, bp, asize, life);
+			return (bp);
+		}
+	}
+
+	/* No fit found.  Grow the top by what it lacks and place the block. */
+	extendsize = asize;
+	if (heap->top != NULL)
+		extendsize -= GET_SIZE(HDRP(heap->top));
+	extendsize = MAX(extendsize, CHUNKSIZE);
+	if ((bp = extend_heap(heap, extendsize / WSIZE, life)) == NULL)
+		return (NULL);
+	place(heap, bp, asize, life);
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   0 < "tag" < MM_NTAGS.
+ *
+ * Effects:
+ *   Allocate a block with at least "size" bytes of payload from "heap",
+ *   unless "size" is zero, and mark it as owned by "tag": in its boundary
+ *   tags or, for a tiny block, by taking it from a tiny page that only
+ *   holds blocks of that tag.  Returns the address of this block if the
+ *   allocation was successful and NULL otherwise.
+ */
+static void *
+malloc_tagged(struct mm_heap *heap, size_t size, int tag)
+{
+	size_t asize;      /* Adjusted block size */
+	int bin;
+	void *bp;
+
+	/* Ignore spurious requests. */
+	if (size == 0)
+		return (NULL);
+
+	heap_lock(heap);
+	if (size <= TINYMAX) {
+		bp = tiny_malloc(heap, size, tag);
+		heap_unlock(heap);
+		return (bp);
+	}
+	asize = adjust_size(size);
+	bin = find_bin(asize);
+	bp = malloc_class(heap, asize, bin, lifetime_table[bin]);
+	if (bp != NULL) {
+		PUT(HDRP(bp), GET_TAG(HDRP(bp)) | PACK_OWNER(tag));
+		PUT(FTRP(bp), GET_TAG(FTRP(bp)) | PACK_OWNER(tag));
+		tag_count(heap, tag, GET_SIZE(HDRP(bp)), 1);
+	}
+	heap_unlock(heap);
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   0 < "tag" < MM_NTAGS, and the caller holds the heap's lock.
+ *
+ * Effects:
+ *   Add "bytes" and "blocks", either of which may be negative, to the
+ *   statistics of "tag".  Plain loads and stores suffice, since only the
+ *   lock holder writes them; readers never see a torn value.
+ */
+static void
+tag_count(struct mm_heap *heap, int tag, ptrdiff_t bytes, ptrdiff_t blocks)
+{
+
+	atomic_store_explicit(&heap->tag_bytes[tag], atomic_load_explicit(
+	    &heap->tag_bytes[tag], memory_order_relaxed) + bytes,
+	    memory_order_relaxed);
+	atomic_store_explicit(&heap->tag_blocks[tag], atomic_load_explicit(
+	    &heap->tag_blocks[tag], memory_order_relaxed) + blocks,
+	    memory_order_relaxed);
+}
+
+/*
+ * Requires:
+ *   "size" is not zero.
+ *
+ * Effects:
+ *   Returns the block size used to satisfy a request for "size" bytes.
+ */
+static size_t
+adjust_size(size_t size)
+{
+
+	/* Adjust block size to include overhead and alignment reqs. */
+	/* Increased size to 4 words of overhead from 2 */
+	/* Smallest useable block size is now 2 words instead of 1 */
+	if (size <= ASIZE)
+		return (ASIZE + QSIZE);
+	return (ASIZE * ((size + QSIZE + (ASIZE - 1)) / ASIZE));
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block.
+ *
+ * Effects:
+ *   Mark the block free, keeping its lifetime class but dropping its tag,
+ *   and coalesce it.
+ */
+static void
+free_block(struct mm_heap *heap, void *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+	int life = GET_LIFE(HDRP(bp));
+
+	char *lo, *hi;
+	size_t n;
+
+	if (GET_OWNER(HDRP(bp)) != 0)
+		tag_count(heap, GET_OWNER(HDRP(bp)), -(ptrdiff_t)size, -1);
+	set_cached(bp, false);
+	PUT(HDRP(bp), PACK_LIFE(size, 0, life));
+	PUT(FTRP(bp), PACK_LIFE(size, 0, life));
+	bp = coalesce(heap, bp);
+
+	/* The block's pages are dirty until purged. */
+	if (heap->dirty_map != NULL) {
+		free_pages_of(heap, bp, &lo, &hi);
+		n = mark_pages(heap, lo, hi, PAGE_USED, PAGE_DIRTY);
+		heap->ndirty += n;
+		heap->dirtied[heap->epoch] += n;
+		decay_tick(heap);
+	}
+	if (heap->stats != NULL) {
+		heap->nfrees++;
+		stats_tick(heap);
+	}
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a newly freed block that is not on any free
+ *   list.
+ *
+ * Effects:
+ *   Perform boundary tag coalescing and insert the result into its free
+ *   list, or make it the top if it ends the heap.  The result takes the
+ *   lifetime class of the largest block merged into it.  Returns the
+ *   address of the coalesced block.
+ */
+static void *
+coalesce(struct mm_heap *heap, void *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+	size_t largest = size;
+	int life = GET_LIFE(HDRP(bp));
+	bool prev_alloc, next_alloc;
+	char *next, *prev;
+
+#ifdef MM_HARDENED
+	/* Never merge with a neighbour whose tags have been overwritten. */
+	if (!TAG_OK(HDRP(bp) - WSIZE) || !TAG_OK(HDRP(NEXT_PHYS_BLKP(bp))))
+		corrupt("bad boundary tag next to", bp);
+	if (!GET_ALLOC(HDRP(bp) - WSIZE) &&
+	    !TAG_OK(HDRP(PREV_PHYS_BLKP(bp))))
+		corrupt("bad boundary tag before", bp);
+#endif
+	prev_alloc = GET_ALLOC(HDRP(bp) - WSIZE);
+	next_alloc = GET_ALLOC(HDRP(NEXT_PHYS_BLKP(bp)));
+	next = NEXT_PHYS_BLKP(bp);
+
+	/* A block freed right below the top just moves the top down. */
+	if (next == heap->top && prev_alloc) {
+		size += GET_SIZE(HDRP(next));
+		life = GET_LIFE(HDRP(next));
+		PUT(HDRP(bp), PACK_LIFE(size, 0, life));
+		PUT(FTRP(bp), PACK_LIFE(size, 0, life));
+		heap->top = bp;
+		return (bp);
+	}
+
+	/* Cases 2 and 4: merge with the next block. */
+	if (!next_alloc) {
+		if (next != heap->top)
+			splice(heap, (struct node *)next);
+		if (GET_SIZE(HDRP(next)) > largest) {
+			largest = GET_SIZE(HDRP(next));
+			life = GET_LIFE(HDRP(next));
+		}
+		size += GET_SIZE(HDRP(next));
+	}
+
+	/* Cases 3 and 4: merge with the previous block. */
+	if (!prev_alloc) {
+		prev = PREV_PHYS_BLKP(bp);
+		if (prev != heap->top)
+			splice(heap, (struct node *)prev);
+		if (GET_SIZE(HDRP(prev)) > largest)
+			life = GET_LIFE(HDRP(prev));
+		size += GET_SIZE(HDRP(prev));
+		bp = prev;
+	}
+
+	PUT(HDRP(bp), PACK_LIFE(size, 0, life));
+	PUT(FTRP(bp), PACK_LIFE(size, 0, life));
+
+	/* A free block that ends the heap is the top. */
+	if (GET_SIZE(HDRP(NEXT_PHYS_BLKP(bp))) == 0)
+		heap->top = bp;
+	else
+		add_to_front(heap, bp);
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   words: the number of words to increase the heap by
+ *   life: the lifetime class of the new memory
+ *
+ * Effects:
+ *   Extend the heap with a free block and return that block's address.
+ */
+static void *
+extend_heap(struct mm_heap *heap, size_t words, int life)
+{
+	size_t size;
+	void *bp;
+	char *lo, *hi;
+
+	/* Allocate an even number of words to maintain alignment. */
+	size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+	if ((bp = mem_region_sbrk(heap->region, size)) == (void *)-1)
+		return (NULL);
+	heap->nsbrk++;
+
+	/* Initialize free block header/footer and the epilogue header. */
+	PUT(HDRP(bp), PACK_LIFE(size, 0, life));   /* Free block header */
+	PUT(FTRP(bp), PACK_LIFE(size, 0, life));   /* Free block footer */
+	PUT(HDRP(NEXT_PHYS_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+
+	/* Fresh pages have never been touched, so they need no purging. */
+	if (heap->dirty_map != NULL) {
+		free_pages_of(heap, bp, &lo, &hi);
+		mark_pages(heap, lo, hi, PAGE_USED, PAGE_CLEAN);
+	}
+
+	/* Coalesce if the previous block was free. */
+	bp = coalesce(heap, bp);
+	if (heap->stats != NULL)
+		stats_publish(heap);
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   "bin" is at least the size class of "asize" and "end" is at most
+ *   NBINS.
+ *
+ * Effects:
+ *   Find a fit for a block with "asize" bytes among the free blocks of
+ *   lifetime class "life", starting with the free list for "bin" and moving
+ *   on to larger classes up to, but not including, "end".  Returns that
+ *   block's address or NULL if no suitable block was found.
+ */
+static void *
+find_fit(struct mm_heap *heap, size_t asize, int bin, int end, int life)
+{
+	struct node *cur;
+#ifdef MM_INDEX
+	struct fit_index *fi;
+	size_t i;
+
+	/* Scan each list's sizes, newest block first, rather than its links. */
+	if (heap->index_ok && asize <= UINT32_MAX) {
+		for (; bin < end; bin++) {
+			fi = &heap->index[life][bin];
+			if ((i = index_scan(fi->sizes, fi->n, asize)) < fi->n)
+				return (heap->heap_listp +
+				    (size_t)fi->offsets[i] * ASIZE);
+		}
+		return (NULL);
+	}
+#endif
+
+	/* Iterate through each list, find first fit */
+	for (; bin < end; bin++) {
+		for (cur = heap->list_start[life][bin]; cur != NULL;
+		    cur = NEXT(cur)) {
+			if (asize <= GET_SIZE(HDRP(cur)))
+				return (cur);
+		}
+	}
+
+	/* No fit was found. */
+	return (NULL);
+}
+
+/*
+ * Requires:
+ *   "bin" is the size class of "asize".
+ *
+ * Effects:
+ *   Find a fit for a block with "asize" bytes on the free list for "bin"
+ *   and lifetime class "life", then in the top, and then among the other
+ *   free blocks, of class "life" first.  Carving a block out of the top
+ *   costs no search of the larger classes, and fresh memory suits either
+ *   lifetime class.  Returns that block's address or NULL if nothing fits.
+ */
+static void *
+fit(struct mm_heap *heap, size_t asize, int bin, int life)
+{
+	void *bp;
+
+	if ((bp = find_fit(heap, asize, bin, bin + 1, life)) != NULL)
+		return (bp);
+	if (heap->top != NULL && GET_SIZE(HDRP(heap->top)) >= asize)
+		return (heap->top);
+	if ((bp = find_fit(heap, asize, bin + 1, NBINS, life)) != NULL)
+		return (bp);
+	return (find_fit(heap, asize, bin, NBINS, !life));
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a free block that is at least "asize" bytes.
+ *
+ * Effects:
+ *   Place a block of "asize" bytes and lifetime class "life" at the start of
+ *   the free block "bp" and split that block if the remainder would be at
+ *   least the minimum block size.  The remainder keeps its class, and is
+ *   the new top if "bp" was the top.
+ */
+static void
+place(struct mm_heap *heap, void *bp, size_t asize, int life)
+{
+	size_t csize = GET_SIZE(HDRP(bp));
+	int rest_life = GET_LIFE(HDRP(bp));
+	char *start = bp;
+	bool top = bp == heap->top;
+
+	/* Remove node from allocated block */
+	if (top)
+		heap->top = NULL;
+	else
+		splice(heap, (struct node *)bp);
+
+	/* increased size to account for next and previous pointer overhead */
+	if ((csize - asize) >= (ASIZE + QSIZE)) {
+		PUT(HDRP(bp), PACK_LIFE(asize, 1, life));
+		PUT(FTRP(bp), PACK_LIFE(asize, 1, life));
+		bp = NEXT_PHYS_BLKP(bp);
+		PUT(HDRP(bp), PACK_LIFE(csize - asize, 0, rest_life));
+		PUT(FTRP(bp), PACK_LIFE(csize - asize, 0, rest_life));
+
+		/* The leftover free block goes back on a free list */
+		if (top)
+			heap->top = bp;
+		else
+			add_to_front(heap, bp);
+	} else {
+		PUT(HDRP(bp), PACK_LIFE(csize, 1, life));
+		PUT(FTRP(bp), PACK_LIFE(csize, 1, life));
+	}
+	if (heap->dirty_map != NULL)
+		decay_reuse(heap, mark_pages(heap, HDRP(start),
+		    FTRP(start) + WSIZE, -1, PAGE_USED));
+	if (heap->stats != NULL) {
+		heap->nallocs++;
+		stats_tick(heap);
+	}
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a free block that is not on any free list.
+ *
+ * Effects:
+ *   Put the block at the front of the free list for its size and lifetime
+ *   classes.
+ */
+static void
+add_to_front(struct mm_heap *heap, void *bp)
+{
+	struct node *nodep = (struct node *)bp;
+	int life = GET_LIFE(HDRP(bp)), bin = find_bin(GET_SIZE(HDRP(bp)));
+	struct node **headp = &heap->list_start[life][bin];
+
+	SET_NEXT(nodep, *headp);
+	SET_PREV(nodep, NULL);
+	if (*headp != NULL)
+		SET_PREV(*headp, nodep);
+	*headp = nodep;
+	if (heap->near_map != NULL)
+		heap->near_map[PAGE_OF(heap, bp)]++;
+	if (heap->stats != NULL) {
+		heap->stats_blocks[bin]++;
+		heap->stats_bytes[bin] += GET_SIZE(HDRP(bp));
+	}
+#ifdef MM_INDEX
+	if (heap->index_ok)
+		index_add(heap, &heap->index[life][bin], bp);
+#endif
+}
+
+/*
+ * Requires:
+ *   "nodep" is the address of a free block on the free list for its size
+ *   and lifetime classes.
+ *
+ * Effects:
+ *   Remove the block from its free list.
+ */
+static void
+splice(struct mm_heap *heap, struct node *nodep)
+{
+	struct node *next = NEXT(nodep), *prev = PREV(nodep);
+	struct node **headp = NULL;
+	size_t size;
+#ifdef MM_INDEX
+	int life = GET_LIFE(HDRP(nodep)), bin = find_bin(GET_SIZE(HDRP(nodep)));
+
+	headp = &heap->list_start[life][bin];
+#else
+
+	if (prev == NULL)
+		headp = &heap->list_start[GET_LIFE(HDRP(nodep))]
+		    [find_bin(GET_SIZE(HDRP(nodep)))];
+#endif
+#ifdef MM_HARDENED
+	if (!LINK_OK(heap->heap_listp, heap->limit, next) ||
+	    !LINK_OK(heap->heap_listp, heap->limit, prev) ||
+	    (next != NULL && PREV(next) != nodep) ||
+	    (prev != NULL ? NEXT(prev) : *headp) != nodep)
+		corrupt("broken free list at", nodep);
+#endif
+	if (prev != NULL)
+		SET_NEXT(prev, next);
+	else
+		*headp = next;
+	if (next != NULL)
+		SET_PREV(next, prev);
+	if (heap->near_map != NULL)
+		heap->near_map[PAGE_OF(heap, nodep)]--;
+	if (heap->stats != NULL) {
+		size = GET_SIZE(HDRP(nodep));
+		heap->stats_blocks[find_bin(size)]--;
+		heap->stats_bytes[find_bin(size)] -= size;
+	}
+#ifdef MM_INDEX
+	if (heap->index_ok)
+		index_remove(heap, &heap->index[life][bin], nodep);
+#endif
+}
+
+#ifdef MM_INDEX
+/*
+ * Requires:
+ *   "bp" is the address of a free block that was just put on its free
+ *   list, and "fi" is that list's side index.
+ *
+ * Effects:
+ *   Append the block to the side index.  If the index cannot grow, give
+ *   up on the side index until the heap is reinitialized.
+ */
+static void
+index_add(struct mm_heap *heap, struct fit_index *fi, void *bp)
+{
+	size_t max;
+	uint32_t *p;
+
+	if (fi->n == fi->max) {
+		max = MAX(2 * fi->max, 64);
+		if ((p = realloc(fi->sizes, max * sizeof(*p))) != NULL)
+			fi->sizes = p;
+		if (p == NULL ||
+		    (p = realloc(fi->offsets, max * sizeof(*p))) == NULL) {
+			heap->index_ok = false;
+			return;
+		}
+		fi->offsets = p;
+		fi->max = max;
+	}
+	fi->sizes[fi->n] = MIN(GET_SIZE(HDRP(bp)), UINT32_MAX);
+	fi->offsets[fi->n] = ((char *)bp - heap->heap_listp) / ASIZE;
+	((struct node *)bp)->slot = fi->n++;
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a free block in the side index "fi".
+ *
+ * Effects:
+ *   Remove the block from the side index, moving the last block of the
+ *   index into its place.
+ */
+static void
+index_remove(struct mm_heap *heap, struct fit_index *fi, void *bp)
+{
+	size_t slot = ((struct node *)bp)->slot;
+
+	if (slot != --fi->n) {
+		fi->sizes[slot] = fi->sizes[fi->n];
+		fi->offsets[slot] = fi->offsets[fi->n];
+		((struct node *)(heap->heap_listp +
+		    (size_t)fi->offsets[slot] * ASIZE))->slot = slot;
+	}
+}
+
+/*
+ * Requires:
+ *   "sizes" holds "n" block sizes and "asize" is not zero.
+ *
+ * Effects:
+ *   Returns the index of the last size of at least "asize" bytes, or "n"
+ *   if there is none.
+ */
+static size_t
+index_scan_scalar(const uint32_t *sizes, size_t n, uint32_t asize)
+{
+	size_t i;
+
+	for (i = n; i > 0; i--) {
+		if (sizes[i - 1] >= asize)
+			return (i - 1);
+	}
+	return (n);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * Requires:
+ *   The CPU supports AVX2, "sizes" holds "n" block sizes and "asize" is
+ *   not zero.
+ *
+ * Effects:
+ *   index_scan_scalar() eight sizes at a time.  The sizes are biased by
+ *   2^31 so that the signed compare orders them as unsigned.
+ */
+__attribute__((target("avx2")))
+static size_t
+index_scan_avx2(const uint32_t *sizes, size_t n, uint32_t asize)
+{
+	__m256i bias = _mm256_set1_epi32(INT32_MIN);
+	__m256i min = _mm256_set1_epi32((int)((asize - 1) ^ 0x80000000u));
+	__m256i v;
+	size_t i, j;
+	int mask;
+
+	for (i = n; i >= 8; i -= 8) {
+		v = _mm256_loadu_si256((const __m256i *)&sizes[i - 8]);
+		v = _mm256_cmpgt_epi32(_mm256_xor_si256(v, bias), min);
+		if ((mask = _mm256_movemask_ps(_mm256_castsi256_ps(v))) != 0)
+			return (i - 8 + 31 - __builtin_clz(mask));
+	}
+	j = index_scan_scalar(sizes, i, asize);
+	return (j < i ? j : n);
+}
+#endif
+
+/*
+ * Requires:
+ *   "heap" has a side index.
+ *
+ * Effects:
+ *   Release the heap's side index.
+ */
+static void
+index_free(struct mm_heap *heap)
+{
+	int bin, life;
+
+	for (life = 0; life < NLIFE; life++) {
+		for (bin = 0; bin < NBINS; bin++) {
+			free(heap->index[life][bin].sizes);
+			free(heap->index[life][bin].offsets);
+		}
+	}
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Choose the index scan for this CPU.
+ */
+static void
+index_setup(void)
+{
+
+	index_scan = index_scan_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		index_scan = index_scan_avx2;
+#endif
+}
+#endif
+
+/*
+ * Requires:
+ *   asize
+ *
+ * Effects:
+ *   Returns bin where size is less than or equal to bin max
+ */
+static int
+find_bin(size_t asize)
+{
+	int bin;
+
+	for (bin = 0; bin < NBINS - 1; bin++) {
+		if (asize <= bin_limits[bin])
+			break;
+	}
+	return (bin);
+}
+
+/*
+ * Requires:
+ *   "heap" has no near map yet.
+ *
+ * Effects:
+ *   Build the near map by counting the free blocks on each page.  From now
+ *   on add_to_front() and splice() keep it up to date.  Returns 0 on
+ *   success and -1 if there is no memory for the map.
+ */
+static int
+near_map_init(struct mm_heap *heap)
+{
+	size_t npages;
+	char *bp;
+
+	npages = mem_region_maxsize(heap->region) / heap->pagesize + 1;
+	if ((heap->near_map = calloc(npages, sizeof(*heap->near_map))) == NULL)
+		return (-1);
+	for (bp = heap->heap_listp; GET_SIZE(HDRP(bp)) > 0;
+	    bp = NEXT_PHYS_BLKP(bp)) {
+		if (!GET_ALLOC(HDRP(bp)) && bp != heap->top)
+			heap->near_map[PAGE_OF(heap, bp)]++;
+	}
+	return (0);
+}
+
+/*
+ * Requires:
+ *   "hint" is the address of an allocated block and "heap" has a near map.
+ *
+ * Effects:
+ *   Find a free block of at least "asize" bytes on the same page as "hint",
+ *   or else the first one after "hint" within NEARPAGES pages, the top
+ *   block included.  Pages that the near map shows to have no free blocks
+ *   are skipped rather than walked.  Returns that block's address or NULL
+ *   if there is none.
+ */
+static void *
+find_near(struct mm_heap *heap, size_t asize, char *hint)
+{
+	size_t page = PAGE_OF(heap, hint);
+	size_t last = page + NEARPAGES;
+	size_t p;
+	char *bp;
+
+	/* Earlier on the same page. */
+	if (heap->near_map[page] > 0) {
+		for (bp = hint; bp != heap->heap_listp &&
+		    PAGE_OF(heap, bp) == page; bp = PREV_PHYS_BLKP(bp)) {
+			if (!GET_ALLOC(HDRP(bp)) && asize <= GET_SIZE(HDRP(bp)))
+				return (bp);
+		}
+	}
+
+	/*
+	 * Later on the same page, then on the following pages.  At the first
+	 * page without free blocks, look the rest up on the free lists rather
+	 * than read every header up to the next page that has some.
+	 */
+	if (last > PAGE_OF(heap, mem_region_hi(heap->region)))
+		last = PAGE_OF(heap, mem_region_hi(heap->region));
+	for (bp = NEXT_PHYS_BLKP(hint); GET_SIZE(HDRP(bp)) > 0 &&
+	    (p = PAGE_OF(heap, bp)) <= last; bp = NEXT_PHYS_BLKP(bp)) {
+		if (heap->near_map[p] == 0 && bp != heap->top) {
+			while (++p <= last && heap->near_map[p] == 0)
+				;
+			if (p <= last && (bp = find_near_listed(heap, asize,
+			    p, last)) != NULL)
+				return (bp);
+
+			/* The top block is on no list, but it comes last. */
+			bp = heap->top;
+			return (bp != NULL && PAGE_OF(heap, bp) <= last &&
+			    asize <= GET_SIZE(HDRP(bp)) ? bp : NULL);
+		}
+		if (!GET_ALLOC(HDRP(bp)) && asize <= GET_SIZE(HDRP(bp)))
+			return (bp);
+	}
+	return (NULL);
+}
+
+/*
+ * Requires:
+ *   "heap" has a near map and "first" is a page of "heap" with free
+ *   blocks.
+ *
+ * Effects:
+ *   Find the lowest free block of at least "asize" bytes that starts on
+ *   pages "first" to "last", through the free lists of the bins that may
+ *   hold one.  Returns that block's address or NULL if there is none.
+ */
+static void *
+find_near_listed(struct mm_heap *heap, size_t asize, size_t first,
+    size_t last)
+{
+	struct node *cur;
+	size_t p;
+	char *best = NULL;
+	int bin, life;
+
+	for (life = 0; life < NLIFE; life++) {
+		for (bin = find_bin(asize); bin < NBINS; bin++) {
+			for (cur = heap->list_start[life][bin]; cur != NULL;
+			    cur = NEXT(cur)) {
+				p = PAGE_OF(heap, cur);
+				if (p >= first && p <= last &&
+				    asize <= GET_SIZE(HDRP(cur)) &&
+				    (best == NULL || (char *)cur < best))
+					best = (char *)cur;
+			}
+		}
+	}
+	return (best);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a block being freed.
+ *
+ * Effects:
+ *   With MM_HARDENED, abort the program if the block's tags have been
+ *   overwritten or the block is not allocated or already in a front-end
+ *   cache, i.e., is being freed twice.  Otherwise, do nothing.
+ */
+static void
+check_free(void *bp)
+{
+
+#ifdef MM_HARDENED
+	if (!TAG_OK(HDRP(bp)))
+		corrupt("bad header", bp);
+	if (!GET_ALLOC(HDRP(bp)) || *(uintptr_t *)bp == CACHE_MARK(bp))
+		corrupt("double free", bp);
+	if (!TAG_OK(FTRP(bp)))
+		corrupt("bad footer", bp);
+#else
+	(void)bp;
+#endif
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block.
+ *
+ * Effects:
+ *   With MM_HARDENED, mark the block as held by a front-end cache or not,
+ *   see CACHE_MARK().  Otherwise, do nothing.
+ */
+static void
+set_cached(void *bp, bool cached)
+{
+
+#ifdef MM_HARDENED
+	*(uintptr_t *)bp = cached ? CACHE_MARK(bp) : 0;
+#else
+	(void)bp;
+	(void)cached;
+#endif
+}
+
+#ifdef MM_HARDENED
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Choose the secret, from the kernel's random source if it can.
+ */
+static void
+secret_init(void)
+{
+	uintptr_t secret;
+
+	if (getrandom(&secret, sizeof(secret), 0) != sizeof(secret))
+		secret = (uintptr_t)&secret ^ (uintptr_t)time(NULL) *
+		    0x9e3779b97f4a7c15u;
+	mm_secret = secret;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Report heap corruption found at "bp" and abort the program, since no
+ *   further request can be trusted.
+ */
+static void
+corrupt(const char *what, void *bp)
+{
+
+	fprintf(stderr, "mm: %s %p, heap corrupted\n", what, bp);
+	abort();
+}
+#endif
+
+/* 
+ * The remaining routines are heap consistency checker routines. 
+ */
+
+/*
+ * Requires:
+ *   "bp" is the address of a block.
+ *
+ * Effects:
+ *   Perform a minimal check on the block "bp".
+ */
+static void
+checkblock(void *bp) 
+{
+
+	if ((uintptr_t)bp % ASIZE)
+		printf("Error: %p is not word aligned\n", bp);
+	if (GET_TAG(HDRP(bp)) != GET_TAG(FTRP(bp)))
+		printf("Error: header does not match footer\n");
+	if (!TAG_OK(HDRP(bp)) || !TAG_OK(FTRP(bp)))
+		printf("Error: %p has a bad tag checksum\n", bp);
+}
+
+/* 
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Perform a minimal check of the heap for consistency. 
+ */
+void
+checkheap(struct mm_heap *heap, bool verbose) 
+{
+	struct node *nodep;
+	char *heap_listp = heap->heap_listp;
+	void *bp;
+	int bin, life;
+
+	if (verbose)
+		printf("Heap (%p):\n", heap_listp);
+
+	if (GET_SIZE(HDRP(heap_listp)) != DSIZE)
+		printf("Bad prologue header: size\n");
+	if (!GET_ALLOC(HDRP(heap_listp)))
 		printf("Bad prologue header: alloc\n");
 	checkblock(heap_listp);
 
-	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_PHYS_BLKP(bp)) {
 		if (verbose)
-			printblock(bp);
+			printblock(heap, bp);
 		checkblock(bp);
 	}
 
 	if (verbose)
-		printblock(bp);
+		printblock(heap, bp);
 	if (GET_SIZE(HDRP(bp)) != 0)
 		printf("Bad epilogue header: size\n");
 	if (!GET_ALLOC(HDRP(bp)))
 		printf("Bad epilogue header: alloc\n");
+	if (heap->top != NULL && (GET_ALLOC(HDRP(heap->top)) ||
+	    NEXT_PHYS_BLKP(heap->top) != bp))
+		printf("Error: top %p is not a free block before the "
+		    "epilogue\n", (void *)heap->top);
+
+	/* Every block on a free list must be free and in the right list. */
+	for (life = 0; life < NLIFE; life++) {
+		for (bin = 0; bin < NBINS; bin++) {
+			for (nodep = heap->list_start[life][bin];
+			    nodep != NULL; nodep = NEXT(nodep)) {
+				if (GET_ALLOC(HDRP(nodep)))
+					printf("Error: %p on free list %d is "
+					    "allocated\n", (void *)nodep, bin);
+				if (find_bin(GET_SIZE(HDRP(nodep))) != bin ||
+				    GET_LIFE(HDRP(nodep)) != life)
+					printf("Error: %p is on the wrong free "
+					    "list\n", (void *)nodep);
+				if (NEXT(nodep) != NULL &&
+				    PREV(NEXT(nodep)) != nodep)
+					printf("Error: free list %d is broken "
+					    "at %p\n", bin, (void *)nodep);
+			}
+		}
+	}
 }
 
 /*
@@ -656,12 +3616,12 @@ checkheap(bool verbose)
  *   Print the block "bp".
  */
 static void
-printblock(void *bp) 
+printblock(struct mm_heap *heap, void *bp) 
 {
 	size_t hsize, fsize;
 	bool halloc, falloc;
 
-	checkheap(false);
+	checkheap(heap, false);
 	hsize = GET_SIZE(HDRP(bp));
 	halloc = GET_ALLOC(HDRP(bp));  
 	fsize = GET_SIZE(FTRP(bp));
@@ -8,6 +8,162 @@ void *mm_malloc(size_t size);
 void mm_free(void *ptr);
 void *mm_realloc(void *ptr, size_t size);
 
+/*
+ * Every block is MM_ALIGN-aligned and carries MM_OVERHEAD bytes of
+ * boundary tags and free-list links besides its payload, except for
+ * requests of up to MM_TINYMAX bytes, which mm_malloc() packs into tiny
+ * pages without tags of their own.
+ */
+#define MM_ALIGN    8
+#define MM_OVERHEAD (4 * sizeof(void *))
+#define MM_TINYMAX  16
+
+/*
+ * The allocator keeps MM_NBINS segregated free lists.  MM_BIN_LIMITS gives
+ * the largest block size (header, footer and padding included) held by
+ * each list but the last, which holds every larger block.  A caller that
+ * already knows a request's block size and class may skip mm_malloc()'s
+ * size computation by calling mm_malloc_class() directly.
+ */
+#define MM_NBINS 12
+#define MM_BIN_LIMITS \
+	32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768
+
+void *mm_malloc_class(size_t asize, int bin);
+int mm_size_class(size_t size);
+
+/*
+ * Lifetime-segregated allocation.  Blocks predicted to be short-lived are
+ * kept apart from long-lived ones.  The prediction is either given with
+ * each request or looked up by size class in a table, e.g., one learned
+ * from a trace.
+ */
+#define MM_HINT_NONE  0 /* Use the table */
+#define MM_HINT_SHORT 1 /* Expected to be freed soon */
+#define MM_HINT_LONG  2 /* Expected to live long */
+
+void *mm_malloc_hint(size_t size, int hint);
+void mm_set_lifetime_table(const int *table);
+
+/*
+ * Independent heaps.  Each mm_heap_t has its own free lists and its own
+ * memlib region, so different heaps may be used from different threads
+ * without locking, and mm_heap_destroy() releases a whole heap at once.
+ * The functions above act on a default heap in the memlib default region.
+ * A heap's own state comes first in its region, so mm_heap_create()
+ * returns NULL for a max_size too small to hold it and a first chunk of
+ * blocks as well.
+ */
+typedef struct mm_heap mm_heap_t;
+
+mm_heap_t *mm_heap_create(size_t max_size);
+void mm_heap_destroy(mm_heap_t *heap);
+void *mm_heap_malloc(mm_heap_t *heap, size_t size);
+void mm_heap_free(mm_heap_t *heap, void *ptr);
+void *mm_heap_realloc(mm_heap_t *heap, void *ptr, size_t size);
+
+/*
+ * Allocate a block close to the block "hint", e.g., the previous node of a
+ * linked structure, so that blocks used together share pages and cache
+ * lines.  A NULL hint makes this mm_malloc().
+ */
+void *mm_malloc_near(size_t size, void *hint);
+void *mm_heap_malloc_near(mm_heap_t *heap, size_t size, void *hint);
+
+/*
+ * Grow an allocated block in place to at least "min" (ideally "preferred")
+ * payload bytes.  Returns the new payload size, or 0 if the block cannot
+ * grow to "min" bytes without moving; the block is then left unchanged.
+ */
+size_t mm_try_expand(void *ptr, size_t min, size_t preferred);
+size_t mm_heap_try_expand(mm_heap_t *heap, void *ptr, size_t min,
+    size_t preferred);
+
+/*
+ * Grow the heap by at least "bytes" bytes of free, pre-faulted memory, so
+ * that first touches of it happen here rather than in later requests.
+ * Returns 0 on success and -1 otherwise.
+ */
+int mm_reserve(size_t bytes);
+int mm_heap_reserve(mm_heap_t *heap, size_t bytes);
+
+/*
+ * Deferred coalescing.  While a heap's consolidator thread runs, freeing a
+ * block only queues it, and the thread coalesces queued blocks in batches.
+ * Other requests on that heap are then serialized by a lock.  Start and
+ * stop the thread while no other thread is using the heap.
+ */
+int mm_consolidator_start(void);
+void mm_consolidator_stop(void);
+int mm_heap_consolidator_start(mm_heap_t *heap);
+void mm_heap_consolidator_stop(mm_heap_t *heap);
+
+/*
+ * Decay-based purging.  Pages of free blocks are returned to the system
+ * gradually over "secs" seconds after they are freed, following a smooth
+ * decay curve, rather than kept until the heap is reset.  "clock" returns
+ * the time in seconds; NULL uses the monotonic clock.  mm_decay() purges
+ * what is due without freeing anything, e.g., while the program is idle.
+ */
+int mm_set_decay(double secs, double (*clock)(void));
+void mm_decay(void);
+int mm_heap_set_decay(mm_heap_t *heap, double secs, double (*clock)(void));
+void mm_heap_decay(mm_heap_t *heap);
+
+/*
+ * Front-end caches.  With caches enabled, mm_malloc() and mm_free() serve
+ * small blocks from a cache per thread (MM_CACHE_THREAD) or per CPU
+ * (MM_CACHE_CPU), which exchanges blocks with the default heap in
+ * batches, and the default heap may be used from several threads at once.
+ * mm_cache_bytes() returns the bytes of free blocks the caches hold.
+ */
+#define MM_CACHE_NONE   0
+#define MM_CACHE_THREAD 1
+#define MM_CACHE_CPU    2
+
+int mm_cache_enable(int mode);
+size_t mm_cache_bytes(void);
+
+/*
+ * Tagged allocation.  mm_malloc_tagged() records the block's owner, a tag
+ * from 1 to MM_NTAGS - 1, e.g., one per subsystem, in the block's header
+ * or, for the smallest blocks, in the header of a page holding only blocks
+ * of that tag.  The live bytes and blocks of each tag are kept up to date
+ * by mm_free() and mm_realloc(), and mm_tag_stats() reads them without
+ * locking.  Tags are only kept on 64-bit machines; elsewhere the counts
+ * stay zero.
+ */
+#define MM_NTAGS 256
+
+typedef struct {
+    size_t bytes;   /* Bytes of live blocks, headers included */
+    size_t blocks;  /* Number of live blocks */
+} mm_tag_stats_t;
+
+void *mm_malloc_tagged(size_t size, int tag);
+mm_tag_stats_t mm_tag_stats(int tag);
+
+/*
+ * Statistics export.  Publish a heap's size, live bytes, free blocks per
+ * bin and request counts in the POSIX shared memory object "name", e.g.,
+ * "/mm.<pid>", laid out as in mmstat.h, where mmstat can watch them while
+ * the program runs.  The counts are kept up to date without system
+ * calls.  A NULL name stops exporting and removes the object.
+ */
+int mm_stats_export(const char *name);
+int mm_heap_stats_export(mm_heap_t *heap, const char *name);
+
+/*
+ * Page-aligned runs of whole pages, e.g., for O_DIRECT buffers.  They come
+ * from a sub-heap of their own and are kept mapped after mm_free_pages(),
+ * so that repeated allocations reuse the same pages.  The sub-heap has a
+ * lock of its own, so these may be called from any thread.
+ */
+#define MM_PAGES_PREFAULT 0x1 /* Fault the pages in before returning them */
+
+void *mm_alloc_pages(size_t npages, int flags);
+void mm_free_pages(void *ptr);
+
 /* 
  * Students work in teams of one or two.  Teams enter their team name, personal
  * names and login IDs in a struct of this type in their mm.c file.
@@ -0,0 +1,209 @@
+/*- -*- mode: c++; c-basic-offset: 8; -*-
+ *
+ * mm_pool.hh - typed C++ front end to the mm.c allocator.
+ *
+ * mm::pool<T> hands out blocks sized for a T.  The block size and size
+ * class of a T are computed at compile time by the constexpr functions
+ * below, from the alignment, overhead and bin table in mm.h, so an
+ * allocation goes straight to mm_malloc_class().  Pool blocks are always
+ * ordinary tagged blocks: unlike mm_malloc(), a pool deliberately does
+ * not pack a T of up to MM_TINYMAX bytes into a tiny page, so that every
+ * T can come from mm_malloc_class() without a size check.
+ *
+ * mm::object_cache<T> adds a LIFO list of freed T blocks in front of the
+ * pool, so that allocating a recently freed T is a single list pop.
+ */
+#ifndef __MM_POOL_HH_
+#define __MM_POOL_HH_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+extern "C" {
+#include "mm.h"
+}
+
+namespace mm {
+
+namespace detail {
+
+constexpr std::size_t align = MM_ALIGN;
+constexpr std::size_t overhead = MM_OVERHEAD;
+
+constexpr std::size_t bin_limits[MM_NBINS - 1] = { MM_BIN_LIMITS };
+
+/*
+ * adjust - return the block size mm_malloc() would use for a request of
+ * "size" bytes, were it not packed into a tiny page.
+ */
+constexpr std::size_t
+adjust(std::size_t size)
+{
+	return (size <= align ? align + overhead :
+	    align * ((size + overhead + (align - 1)) / align));
+}
+
+/*
+ * bin_of - return the size class of a block of "asize" bytes.
+ */
+constexpr int
+bin_of(std::size_t asize)
+{
+	int bin = 0;
+
+	while (bin < MM_NBINS - 1 && asize > bin_limits[bin])
+		bin++;
+	return (bin);
+}
+
+} /* namespace detail */
+
+template <typename T>
+class pool {
+public:
+	static_assert(alignof(T) <= detail::align,
+	    "mm_malloc only guarantees 8-byte alignment");
+
+	/* Block size and size class of every T, fixed at compile time. */
+	static constexpr std::size_t block_size = detail::adjust(sizeof(T));
+	static constexpr int size_class = detail::bin_of(block_size);
+
+	static_assert(block_size % MM_ALIGN == 0 &&
+	    block_size >= sizeof(T) + MM_OVERHEAD,
+	    "block_size must hold a T and mm.c's overhead");
+
+	/* Return uninitialized storage for a T, or nullptr. */
+	static T *
+	allocate()
+	{
+		return (static_cast<T *>(mm_malloc_class(block_size,
+		    size_class)));
+	}
+
+	static void
+	deallocate(T *p)
+	{
+		mm_free(p);
+	}
+
+	template <typename... Args>
+	static T *
+	create(Args &&...args)
+	{
+		void *p = allocate();
+
+		if (p == nullptr)
+			throw std::bad_alloc();
+		return (new (p) T(std::forward<Args>(args)...));
+	}
+
+	static void
+	destroy(T *p)
+	{
+		if (p == nullptr)
+			return;
+		p->~T();
+		deallocate(p);
+	}
+};
+
+template <typename T>
+class object_cache {
+public:
+	/* Keep at most "limit" freed blocks before returning them to mm. */
+	explicit object_cache(std::size_t limit = 256)
+	    : head(nullptr), count(0), limit(limit) {}
+
+	object_cache(const object_cache &) = delete;
+	object_cache &operator=(const object_cache &) = delete;
+
+	~object_cache()
+	{
+		trim(0);
+	}
+
+	T *
+	allocate()
+	{
+		slot *s = head;
+
+		if (s == nullptr)
+			return (pool<T>::allocate());
+		head = s->next;
+		count--;
+		return (reinterpret_cast<T *>(s));
+	}
+
+	void
+	deallocate(T *p)
+	{
+		slot *s;
+
+		if (p == nullptr)
+			return;
+		if (count >= limit) {
+			pool<T>::deallocate(p);
+			return;
+		}
+		s = reinterpret_cast<slot *>(p);
+		s->next = head;
+		head = s;
+		count++;
+	}
+
+	template <typename... Args>
+	T *
+	create(Args &&...args)
+	{
+		void *p = allocate();
+
+		if (p == nullptr)
+			throw std::bad_alloc();
+		return (new (p) T(std::forward<Args>(args)...));
+	}
+
+	void
+	destroy(T *p)
+	{
+		if (p == nullptr)
+			return;
+		p->~T();
+		deallocate(p);
+	}
+
+	/* Return cached blocks to mm until at most "keep" remain. */
+	void
+	trim(std::size_t keep)
+	{
+		slot *s;
+
+		while (count > keep) {
+			s = head;
+			head = s->next;
+			count--;
+			pool<T>::deallocate(reinterpret_cast<T *>(s));
+		}
+	}
+
+	std::size_t
+	cached() const
+	{
+		return (count);
+	}
+
+private:
+	/* A cached block; every mm block has room for at least one word. */
+	struct slot {
+		slot *next;
+	};
+
+	slot *head;
+	std::size_t count;
+	std::size_t limit;
+};
+
+} /* namespace mm */
+
+#endif /* __MM_POOL_HH_ */
@@ -0,0 +1,178 @@
+/*
+ * mmstat.c - watch the statistics that a running program exports with
+ * mm_stats_export(), without stopping or slowing it.
+ *
+ * Every interval, mmstat takes a consistent snapshot of the shared page
+ * (see mmstat.h) and prints the heap size, the live bytes and how much of
+ * the heap they use, and the rates of allocations, frees and mem_sbrk
+ * calls since the previous snapshot.  With -b it also prints the number
+ * of free blocks on each bin's lists.  It stops after -n snapshots, or
+ * once the exporting process is gone.
+ *
+ * usage: mmstat [-b] [-i <secs>] [-n <count>] <name>
+ */
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mmstat.h"
+
+#define INTERVAL 1.0 /* default secs between snapshots */
+#define HEADEVERY 20 /* snapshots between column headings */
+
+/* A consistent copy of the shared page's counters */
+typedef struct {
+    uint64_t heap_size, live_bytes;
+    uint64_t sbrk_calls, allocs, frees;
+    uint64_t free_blocks[MM_NBINS];
+} snap_t;
+
+/*
+ * snapshot - copy the counters out of the page, retrying while the
+ *     writer is part way through an update
+ */
+static void snapshot(struct mmstat_page *sp, snap_t *s)
+{
+    uint64_t seq;
+    int bin;
+
+    for (;;) {
+	seq = atomic_load_explicit(&sp->seq, memory_order_acquire);
+	if (seq % 2 == 0) {
+	    s->heap_size = atomic_load_explicit(&sp->heap_size,
+						memory_order_relaxed);
+	    s->live_bytes = atomic_load_explicit(&sp->live_bytes,
+						 memory_order_relaxed);
+	    s->sbrk_calls = atomic_load_explicit(&sp->sbrk_calls,
+						 memory_order_relaxed);
+	    s->allocs = atomic_load_explicit(&sp->allocs,
+					     memory_order_relaxed);
+	    s->frees = atomic_load_explicit(&sp->frees, memory_order_relaxed);
+	    for (bin = 0; bin < MM_NBINS; bin++)
+		s->free_blocks[bin] = atomic_load_explicit(
+		    &sp->free_blocks[bin], memory_order_relaxed);
+	    atomic_thread_fence(memory_order_acquire);
+	    if (atomic_load_explicit(&sp->seq, memory_order_relaxed) == seq)
+		return;
+	}
+	sched_yield();
+    }
+}
+
+/*
+ * rate - events per second between two readings of a counter, which
+ *     starts over from zero if the program reinitializes the heap
+ */
+static double rate(uint64_t now, uint64_t then, double secs)
+{
+    return (now >= then ? now - then : now) / secs;
+}
+
+static double now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmstat [-b] [-i <secs>] [-n <count>] <name>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b         Print the free blocks in each bin.\n");
+    fprintf(stderr, "\t-i <secs>  Seconds between snapshots.\n");
+    fprintf(stderr, "\t-n <count> Stop after <count> snapshots.\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct mmstat_page *sp;
+    struct timespec nap;
+    double interval = INTERVAL, then, now;
+    snap_t prev, cur;
+    char heading[16];
+    long count = -1, n;
+    int bins = 0, bin, c;
+
+    while ((c = getopt(argc, argv, "bi:n:h")) != EOF) {
+	switch (c) {
+	case 'b':
+	    bins = 1;
+	    break;
+	case 'i':
+	    interval = atof(optarg);
+	    break;
+	case 'n':
+	    count = atol(optarg);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind != argc - 1 || interval <= 0) {
+	usage();
+	exit(1);
+    }
+
+    if ((sp = mem_shared_attach(argv[optind], sizeof(*sp))) == NULL) {
+	fprintf(stderr, "mmstat: cannot attach to %s\n", argv[optind]);
+	exit(1);
+    }
+    if (sp->magic != MMSTAT_MAGIC || sp->nbins != MM_NBINS) {
+	fprintf(stderr, "mmstat: %s is not an mm statistics page\n",
+		argv[optind]);
+	exit(1);
+    }
+
+    nap.tv_sec = (time_t)interval;
+    nap.tv_nsec = (long)((interval - nap.tv_sec) * 1e9);
+    snapshot(sp, &prev);
+    then = now_secs();
+    for (n = 0; count < 0 || n < count; n++) {
+	nanosleep(&nap, NULL);
+	snapshot(sp, &cur);
+	now = now_secs();
+
+	if (n % HEADEVERY == 0) {
+	    printf("%10s%10s%6s%12s%12s%8s", "heap KB", "live KB", "util",
+		   "allocs/s", "frees/s", "sbrk/s");
+	    if (bins)
+		for (bin = 0; bin < MM_NBINS; bin++) {
+		    sprintf(heading, "bin%d", bin);
+		    printf("%7s", heading);
+		}
+	    printf("\n");
+	}
+	printf("%10.0f%10.0f%5.0f%%%12.0f%12.0f%8.0f",
+	       cur.heap_size / 1024.0, cur.live_bytes / 1024.0,
+	       cur.heap_size ? 100.0 * cur.live_bytes / cur.heap_size : 0.0,
+	       rate(cur.allocs, prev.allocs, now - then),
+	       rate(cur.frees, prev.frees, now - then),
+	       rate(cur.sbrk_calls, prev.sbrk_calls, now - then));
+	if (bins)
+	    for (bin = 0; bin < MM_NBINS; bin++)
+		printf("%7llu", (unsigned long long)cur.free_blocks[bin]);
+	printf("\n");
+	fflush(stdout);
+
+	/* Stop once the program is gone; its last counts stay readable */
+	if (kill((pid_t)sp->pid, 0) < 0 && errno == ESRCH)
+	    break;
+	prev = cur;
+	then = now;
+    }
+    return 0;
+}
@@ -0,0 +1,27 @@
+/*
+ * The layout of the shared memory object that mm_stats_export() publishes
+ * a heap's statistics in, and that mmstat reads.  Include stdatomic.h,
+ * stdint.h and mm.h first.
+ *
+ * The page is a seqlock: the writer makes "seq" odd, updates the fields
+ * and makes "seq" even again, so a reader that sees the same even "seq"
+ * before and after copying the fields has a consistent snapshot.  Every
+ * field is atomic only so that concurrent reads are well defined; the
+ * writer updates them with plain relaxed stores.
+ */
+#define MMSTAT_MAGIC 0x6d6d7374 /* "mmst" */
+
+struct mmstat_page {
+    uint32_t magic;                   /* MMSTAT_MAGIC once set up */
+    uint32_t nbins;                   /* MM_NBINS of the writer */
+    int64_t pid;                      /* process that exports the heap */
+    _Atomic uint64_t seq;             /* odd while an update is under way */
+    _Atomic uint64_t heap_size;       /* bytes of heap, from mem_sbrk */
+    _Atomic uint64_t live_bytes;      /* bytes of allocated blocks */
+    _Atomic uint64_t top_bytes;       /* bytes of free space ending the heap */
+    _Atomic uint64_t sbrk_calls;      /* mem_sbrk calls since mm_init */
+    _Atomic uint64_t allocs;          /* blocks allocated since export */
+    _Atomic uint64_t frees;           /* blocks freed since export */
+    _Atomic uint64_t free_blocks[MM_NBINS]; /* blocks on each bin's lists */
+    _Atomic uint64_t free_bytes[MM_NBINS];  /* ... and their bytes */
+};
@@ -0,0 +1,195 @@
+/*
+ * nearbench.c - measure what mm_malloc_near() buys a linked structure.
+ *
+ * The heap is first fragmented by allocating blocks of random sizes and
+ * freeing every other one.  A linked list is then built, with a block of
+ * unrelated "noise" allocated after each node, once with mm_malloc(),
+ * once with mm_malloc_near() hinted at the previous node, and once hinted
+ * at a KEYSIZE-byte key allocated just before the node, which mm_malloc()
+ * packs into a tiny page.  For each list
+ * we report the mean distance between linked nodes, how many of the links
+ * stay within one page, the time per
+ * traversal, and the cache misses per traversal when the kernel lets us
+ * count them.
+ *
+ * usage: nearbench
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "ftimer.h"
+
+#define NFRAG    30000 /* blocks allocated to fragment the heap */
+#define NNODES   40000 /* nodes in the list */
+#define NPASSES  50    /* traversals averaged by ftimer_gettod */
+#define KEYSIZE  8     /* bytes per key, small enough for a tiny page */
+
+/* What build_list() hints each node at */
+#define HINT_NONE 0    /* nothing: plain mm_malloc() */
+#define HINT_PREV 1    /* the previous node */
+#define HINT_KEY  2    /* the node's key */
+
+typedef struct node {
+    struct node *next;
+    long key;
+    char pad[32];
+} node_t;
+
+static node_t *head;        /* list being traversed */
+static volatile long sum;   /* keeps the traversals from being optimized away */
+
+/*
+ * random_size - a size between 16 and 256 bytes
+ */
+static size_t random_size(void)
+{
+    return 16 + (size_t)(rand() % 241);
+}
+
+/*
+ * fragment - leave holes of random sizes all through a fresh heap
+ */
+static void fragment(void)
+{
+    static void *blocks[NFRAG];
+    int i;
+
+    for (i = 0; i < NFRAG; i++)
+	blocks[i] = mm_malloc(random_size());
+    for (i = 0; i < NFRAG; i += 2)
+	mm_free(blocks[i]);
+}
+
+/*
+ * build_list - build the list, hinting each node as "hint" says; return
+ *     the mean distance between linked nodes and the fraction of links
+ *     within one page through *samepage
+ */
+static double build_list(int hint, double *samepage)
+{
+    node_t *prev = NULL, *p;
+    uintptr_t pagemask = ~(uintptr_t)(mem_pagesize() - 1);
+    double dist = 0;
+    void *key;
+    int i, same = 0;
+
+    for (i = 0; i < NNODES; i++) {
+	if (hint == HINT_KEY) {
+	    if ((key = mm_malloc(KEYSIZE)) == NULL) {
+		fprintf(stderr, "nearbench: out of memory\n");
+		exit(1);
+	    }
+	    memset(key, 0xff, KEYSIZE);   /* nonsense, if read as tags */
+	    p = mm_malloc_near(sizeof(node_t), key);
+	} else if (hint == HINT_PREV)
+	    p = mm_malloc_near(sizeof(node_t), prev);
+	else
+	    p = mm_malloc(sizeof(node_t));
+	if (p == NULL) {
+	    fprintf(stderr, "nearbench: out of memory\n");
+	    exit(1);
+	}
+	p->next = NULL;
+	p->key = i;
+	if (prev == NULL)
+	    head = p;
+	else {
+	    prev->next = p;
+	    dist += labs((char *)p - (char *)prev);
+	    same += ((uintptr_t)p & pagemask) == ((uintptr_t)prev & pagemask);
+	}
+	prev = p;
+	mm_malloc(random_size());   /* noise, never freed */
+    }
+    *samepage = (double)same / (NNODES - 1);
+    return dist / (NNODES - 1);
+}
+
+static void traverse(void *argp)
+{
+    node_t *p;
+    long s = 0;
+
+    (void)argp;
+    for (p = head; p != NULL; p = p->next)
+	s += p->key;
+    sum = s;
+}
+
+/*
+ * open_misses - open a counter of cache misses for this process, or
+ *     return -1 if perf events are not available
+ */
+static int open_misses(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void run(const char *name, int hint, int fd)
+{
+    double dist, samepage, secs;
+    long long misses;
+    char buf[32];
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	fprintf(stderr, "nearbench: mm_init failed\n");
+	exit(1);
+    }
+    srand(1);
+    fragment();
+    dist = build_list(hint, &samepage);
+
+    traverse(NULL);   /* warm up */
+    secs = ftimer_gettod(traverse, NULL, NPASSES);
+
+    strcpy(buf, "n/a");
+    if (fd >= 0) {
+	ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+	ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	traverse(NULL);
+	ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(fd, &misses, sizeof(misses)) == sizeof(misses))
+	    snprintf(buf, sizeof(buf), "%lld", misses);
+    }
+    printf("%-16s %12.0f %10.0f%% %12.1f %14s\n", name, dist,
+	   samepage * 100, secs * 1e6, buf);
+}
+
+int main(void)
+{
+    int fd;
+
+    mem_init();
+    fd = open_misses();
+    printf("%d nodes of %zu bytes, %d fragmenting blocks\n",
+	   NNODES, sizeof(node_t), NFRAG);
+    printf("%-16s %12s %11s %12s %14s\n", "allocator", "mean link B",
+	   "same page", "us/traverse", "misses/trav");
+    run("mm_malloc", HINT_NONE, fd);
+    run("mm_malloc_near", HINT_PREV, fd);
+    run("..near a key", HINT_KEY, fd);
+
+    if (fd >= 0)
+	close(fd);
+    mem_deinit();
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * poolbench.cc - compare mm::pool<T> and mm::object_cache<T> against
+ *     "new T" and a plain mm_malloc(sizeof(T)).
+ *
+ * Each run allocates NOBJS objects of one type and then frees them all,
+ * so the heap returns to the same state between runs.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+extern "C" {
+#include "memlib.h"
+#include "ftimer.h"
+}
+#include "mm_pool.hh"
+
+#define NOBJS  20000 /* objects allocated per run */
+#define NRUNS  50    /* runs averaged by ftimer_gettod */
+
+struct small_obj {
+	std::uint64_t key;
+	std::uint64_t value;
+	small_obj *next;
+};
+
+static small_obj *objs[NOBJS];
+static mm::object_cache<small_obj> *cache;
+
+static void
+run_new(void *argp)
+{
+	int i;
+
+	(void)argp;
+	for (i = 0; i < NOBJS; i++)
+		objs[i] = new small_obj;
+	for (i = 0; i < NOBJS; i++)
+		delete objs[i];
+}
+
+static void
+run_mm_malloc(void *argp)
+{
+	int i;
+
+	(void)argp;
+	for (i = 0; i < NOBJS; i++)
+		objs[i] = static_cast<small_obj *>(mm_malloc(sizeof(small_obj)));
+	for (i = 0; i < NOBJS; i++)
+		mm_free(objs[i]);
+}
+
+static void
+run_pool(void *argp)
+{
+	int i;
+
+	(void)argp;
+	for (i = 0; i < NOBJS; i++)
+		objs[i] = mm::pool<small_obj>::allocate();
+	for (i = 0; i < NOBJS; i++)
+		mm::pool<small_obj>::deallocate(objs[i]);
+}
+
+static void
+run_cache(void *argp)
+{
+	int i;
+
+	(void)argp;
+	for (i = 0; i < NOBJS; i++)
+		objs[i] = cache->allocate();
+	for (i = 0; i < NOBJS; i++)
+		cache->deallocate(objs[i]);
+}
+
+static void
+report(const char *name, ftimer_test_funct f)
+{
+	double secs;
+
+	f(NULL); /* warm up the heap */
+	secs = ftimer_gettod(f, NULL, NRUNS);
+	printf("%-16s %10.0f Kops\n", name, (2.0 * NOBJS / 1e3) / secs);
+}
+
+int
+main(void)
+{
+	mem_init();
+	if (mm_init() < 0) {
+		fprintf(stderr, "poolbench: mm_init failed\n");
+		exit(1);
+	}
+	cache = new mm::object_cache<small_obj>(NOBJS);
+
+	printf("sizeof(T) = %zu, block size = %zu, size class = %d\n",
+	    sizeof(small_obj), mm::pool<small_obj>::block_size,
+	    mm::pool<small_obj>::size_class);
+	report("new T", run_new);
+	report("mm_malloc", run_mm_malloc);
+	report("mm::pool", run_pool);
+	report("mm::object_cache", run_cache);
+
+	delete cache;
+	mem_deinit();
+	return (0);
+}
@@ -0,0 +1,126 @@
+/*
+ * threadtest.c - a threadtest-style benchmark of mm_malloc() bursts.
+ *
+ * A fixed amount of work, NITER iterations of allocating NOBJS blocks of
+ * OBJSIZE bytes and then freeing them all, is divided among nthreads
+ * threads, each of which allocates and frees its own share of the blocks
+ * in every iteration.  No block crosses threads, so an allocator that
+ * scales should finish in 1/nthreads of the time, up to the number of
+ * CPUs.  The run is repeated for 1 to nthreads threads, and for each we
+ * report the throughput and the heap size, which mem_sbrk() never lets
+ * shrink and so is also the peak heap size.
+ *
+ * usage: threadtest [-c thread|cpu] [nthreads]
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define NTHREADS 8      /* default largest number of threads */
+#define NITER    50     /* bursts */
+#define NOBJS    30000  /* blocks per burst, shared among the threads */
+#define OBJSIZE  64     /* bytes per block */
+
+static int nobjs;       /* blocks per burst for each thread */
+
+/*
+ * worker - allocate a burst of blocks, touching each, then free them all
+ */
+static void *worker(void *arg)
+{
+    void **blocks;
+    int i, j;
+
+    (void)arg;
+    if ((blocks = malloc(nobjs * sizeof(void *))) == NULL) {
+	fprintf(stderr, "threadtest: out of memory\n");
+	exit(1);
+    }
+    for (i = 0; i < NITER; i++) {
+	for (j = 0; j < nobjs; j++) {
+	    if ((blocks[j] = mm_malloc(OBJSIZE)) == NULL) {
+		fprintf(stderr, "threadtest: out of memory\n");
+		exit(1);
+	    }
+	    *(char *)blocks[j] = (char)j;
+	}
+	for (j = 0; j < nobjs; j++)
+	    mm_free(blocks[j]);
+    }
+    free(blocks);
+    return NULL;
+}
+
+static void run(int mode, int nthreads)
+{
+    pthread_t *threads;
+    struct timeval start, end;
+    double secs;
+    int i;
+
+    mem_reset_brk();
+    if (mm_init() < 0 || mm_cache_enable(mode) < 0) {
+	fprintf(stderr, "threadtest: cannot set up the caches\n");
+	exit(1);
+    }
+    if ((threads = malloc(nthreads * sizeof(pthread_t))) == NULL) {
+	fprintf(stderr, "threadtest: out of memory\n");
+	exit(1);
+    }
+    nobjs = NOBJS / nthreads;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nthreads; i++)
+	pthread_create(&threads[i], NULL, worker, NULL);
+    for (i = 0; i < nthreads; i++)
+	pthread_join(threads[i], NULL);
+    gettimeofday(&end, NULL);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    printf("%7d %10.0f %10zu\n", nthreads,
+	   (double)nthreads * nobjs * NITER * 2 / secs / 1e3,
+	   mem_heapsize() / 1024);
+    free(threads);
+    mm_cache_enable(MM_CACHE_NONE);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: threadtest [-c thread|cpu] [nthreads]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int mode = MM_CACHE_THREAD, nthreads = NTHREADS, n, c;
+
+    while ((c = getopt(argc, argv, "c:")) != EOF) {
+	if (c != 'c')
+	    usage();
+	if (strcmp(optarg, "thread") == 0)
+	    mode = MM_CACHE_THREAD;
+	else if (strcmp(optarg, "cpu") == 0)
+	    mode = MM_CACHE_CPU;
+	else
+	    usage();
+    }
+    if (optind < argc && (nthreads = atoi(argv[optind])) < 1)
+	usage();
+
+    mem_init();
+    printf("%d bursts of %d blocks of %d bytes, shared among the threads, "
+	   "%s caches\n", NITER, NOBJS, OBJSIZE,
+	   mode == MM_CACHE_THREAD ? "per-thread" : "per-CPU");
+    printf("%7s %10s %10s\n", "threads", "Kops", "heap KB");
+    for (n = 1; n <= nthreads; n++)
+	run(mode, n);
+    mem_deinit();
+    return 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * Trace requests, and the binary trace format.  Include stdint.h first.
+ *
+ * A binary trace holds the same requests as a text .rep trace: a
+ * tracehdr_t followed by num_ops traceop_t records, in the byte order of
+ * the machine that wrote it.  Since the records are laid out exactly as
+ * mdriver keeps requests in memory, mdriver maps a binary trace and uses
+ * the records in place, without parsing them, after one pass that checks
+ * every record, since the file may not have come from tracebin.  Binary
+ * traces have no thread ids; every request comes from thread 0.
+ */
+#define TRACE_MAGIC "mmtrace1" /* version 1; 8 bytes, no NUL */
+
+/* The header of a binary trace */
+typedef struct {
+    char magic[8];            /* TRACE_MAGIC */
+    uint32_t sugg_heapsize;   /* suggested heap size (unused) */
+    uint32_t num_ids;         /* number of alloc/realloc ids */
+    uint32_t num_ops;         /* number of distinct requests */
+    uint32_t weight;          /* weight for this trace (unused) */
+} tracehdr_t;
+
+/* Characterizes a single trace operation (allocator request) */
+enum {ALLOC, FREE, REALLOC};  /* type of request */
+typedef struct {
+    int32_t type;             /* ALLOC, FREE or REALLOC */
+    int32_t index;            /* index for free() to use later */
+    int32_t size;             /* byte size of alloc/realloc request */
+} traceop_t;
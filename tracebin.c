@@ -0,0 +1,91 @@
+/*
+ * tracebin.c - convert a text .rep trace to the binary trace format of
+ * trace.h, which mdriver maps instead of parsing.
+ *
+ * The requests are checked as they are converted: every id must be below
+ * the header's num_ids and the number of requests must match num_ops.
+ * Multi-threaded traces, whose requests carry thread ids, stay text.
+ *
+ * usage: tracebin <in.rep> <out>
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+/*
+ * bad_trace - report a malformed input trace and give up
+ */
+static void bad_trace(const char *path, unsigned op, const char *why)
+{
+    fprintf(stderr, "tracebin: %s, request %u: %s\n", path, op, why);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    tracehdr_t hdr;
+    traceop_t op;
+    char type[2];
+    unsigned index, size, n;
+
+    if (argc != 3) {
+	fprintf(stderr, "Usage: tracebin <in.rep> <out>\n");
+	exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL) {
+	perror(argv[1]);
+	exit(1);
+    }
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    if (fscanf(in, "%u %u %u %u", &hdr.sugg_heapsize, &hdr.num_ids,
+	       &hdr.num_ops, &hdr.weight) != 4)
+	bad_trace(argv[1], 0, "bad header");
+    if ((out = fopen(argv[2], "w")) == NULL) {
+	perror(argv[2]);
+	exit(1);
+    }
+    fwrite(&hdr, sizeof(hdr), 1, out);
+
+    /* Convert the requests one at a time, checking each */
+    for (n = 0; fscanf(in, "%1s", type) == 1; n++) {
+	if (n == hdr.num_ops)
+	    bad_trace(argv[1], n, "more requests than the header says");
+	size = 0;
+	switch (type[0]) {
+	case 'a':
+	case 'r':
+	    if (fscanf(in, "%u %u", &index, &size) != 2)
+		bad_trace(argv[1], n, "bad request");
+	    op.type = type[0] == 'a' ? ALLOC : REALLOC;
+	    break;
+	case 'f':
+	    if (fscanf(in, "%u", &index) != 1)
+		bad_trace(argv[1], n, "bad request");
+	    op.type = FREE;
+	    break;
+	case 't':
+	    bad_trace(argv[1], n, "binary traces have no thread ids");
+	    break;
+	default:
+	    bad_trace(argv[1], n, "unknown request type");
+	}
+	if (index >= hdr.num_ids || size > INT32_MAX)
+	    bad_trace(argv[1], n, "id or size out of range");
+	op.index = index;
+	op.size = size;
+	fwrite(&op, sizeof(op), 1, out);
+    }
+    if (n != hdr.num_ops)
+	bad_trace(argv[1], n, "fewer requests than the header says");
+
+    fclose(in);
+    if (fclose(out) != 0) {
+	perror(argv[2]);
+	exit(1);
+    }
+    return 0;
+}
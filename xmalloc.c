@@ -0,0 +1,173 @@
+/*
+ * xmalloc.c - an xmalloc-style benchmark of frees on other threads.
+ *
+ * Each of nthreads threads repeatedly allocates a batch of BATCH blocks
+ * of random size, puts the batch at the tail of a queue shared by all the
+ * threads, and takes the batch at the head of the queue and frees its
+ * blocks.  With more than one thread, the batch taken is usually another
+ * thread's, so most blocks are freed remotely, as between the producers
+ * and consumers of a pipeline.  The run is repeated for 1 to nthreads
+ * threads, and for each we report the throughput and the heap size,
+ * which mem_sbrk() never lets shrink and so is also the peak heap size.
+ *
+ * usage: xmalloc [-c thread|cpu] [nthreads]
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define NTHREADS 8      /* default largest number of threads */
+#define NBATCHES 2000   /* batches allocated by each thread */
+#define BATCH    64     /* blocks in a batch */
+#define MAXSIZE  128    /* largest request */
+
+/* A batch of blocks, allocated by one thread and freed by another */
+typedef struct batch {
+    struct batch *next;
+    void *blocks[BATCH];
+} batch_t;
+
+/* The queue of batches waiting to be freed */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static batch_t *head, *tail;
+
+static void *bench_malloc(size_t size)
+{
+    void *p;
+
+    if ((p = mm_malloc(size)) == NULL) {
+	fprintf(stderr, "xmalloc: out of memory\n");
+	exit(1);
+    }
+    *(char *)p = (char)size;
+    return p;
+}
+
+static void put(batch_t *b)
+{
+    b->next = NULL;
+    pthread_mutex_lock(&lock);
+    if (tail != NULL)
+	tail->next = b;
+    else
+	head = b;
+    tail = b;
+    pthread_mutex_unlock(&lock);
+}
+
+static batch_t *take(void)
+{
+    batch_t *b;
+
+    pthread_mutex_lock(&lock);
+    if ((b = head) != NULL && (head = b->next) == NULL)
+	tail = NULL;
+    pthread_mutex_unlock(&lock);
+    return b;
+}
+
+static void free_batch(batch_t *b)
+{
+    int i;
+
+    for (i = 0; i < BATCH; i++)
+	mm_free(b->blocks[i]);
+    mm_free(b);
+}
+
+/*
+ * worker - allocate and queue batches, freeing one from the queue for
+ *     each
+ */
+static void *worker(void *arg)
+{
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    batch_t *b;
+    int i, j;
+
+    for (i = 0; i < NBATCHES; i++) {
+	b = bench_malloc(sizeof(batch_t));
+	for (j = 0; j < BATCH; j++)
+	    b->blocks[j] = bench_malloc(1 + rand_r(&seed) % MAXSIZE);
+	put(b);
+	if ((b = take()) != NULL)
+	    free_batch(b);
+    }
+    return NULL;
+}
+
+static void run(int mode, int nthreads)
+{
+    pthread_t *threads;
+    struct timeval start, end;
+    batch_t *b;
+    double secs;
+    int i;
+
+    mem_reset_brk();
+    if (mm_init() < 0 || mm_cache_enable(mode) < 0) {
+	fprintf(stderr, "xmalloc: cannot set up the caches\n");
+	exit(1);
+    }
+    if ((threads = malloc(nthreads * sizeof(pthread_t))) == NULL) {
+	fprintf(stderr, "xmalloc: out of memory\n");
+	exit(1);
+    }
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nthreads; i++)
+	pthread_create(&threads[i], NULL, worker, (void *)(uintptr_t)(i + 1));
+    for (i = 0; i < nthreads; i++)
+	pthread_join(threads[i], NULL);
+    gettimeofday(&end, NULL);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    printf("%7d %10.0f %10zu\n", nthreads,
+	   (double)nthreads * NBATCHES * (BATCH + 1) * 2 / secs / 1e3,
+	   mem_heapsize() / 1024);
+    while ((b = take()) != NULL)
+	free_batch(b);
+    free(threads);
+    mm_cache_enable(MM_CACHE_NONE);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: xmalloc [-c thread|cpu] [nthreads]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int mode = MM_CACHE_THREAD, nthreads = NTHREADS, n, c;
+
+    while ((c = getopt(argc, argv, "c:")) != EOF) {
+	if (c != 'c')
+	    usage();
+	if (strcmp(optarg, "thread") == 0)
+	    mode = MM_CACHE_THREAD;
+	else if (strcmp(optarg, "cpu") == 0)
+	    mode = MM_CACHE_CPU;
+	else
+	    usage();
+    }
+    if (optind < argc && (nthreads = atoi(argv[optind])) < 1)
+	usage();
+
+    mem_init();
+    printf("%d batches of %d blocks of 1..%d bytes per thread, freed from "
+	   "a shared queue, %s caches\n", NBATCHES, BATCH, MAXSIZE,
+	   mode == MM_CACHE_THREAD ? "per-thread" : "per-CPU");
+    printf("%7s %10s %10s\n", "threads", "Kops", "heap KB");
+    for (n = 1; n <= nthreads; n++)
+	run(mode, n);
+    mem_deinit();
+    return 0;
+}